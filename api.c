@@ -0,0 +1,272 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "api.h"
+#include "board.h"
+#include "report.h"
+#include "arrivals.h"
+#include "render.h"
+#include "json.h"
+#include "mem.h"
+#include "util.h"
+#include "trace.h"
+#include "version.h"
+
+static const char *api_methods =
+	"Departures API methods:\n"
+	"\n"
+	"/v1/help                -- show this help\n"
+	"/v1/version             -- show version, build date, etc\n"
+	"/v1/list                -- list NJT station code and name\n"
+	"/v1/station/XX          -- list departures for station code\n"
+	"/v1/departures/XX/YY    -- next trains from XX to YY with previous stops status,\n"
+	"                           or a trip with transfers if no train goes there\n"
+	"/v1/departures/XX,ZZ/YY -- next trains from XX or ZZ to YY in departure order\n"
+	"/v1/arrivals/XX         -- trains arriving at station code from the loaded boards\n"
+	"/v1/events/XX           -- stream of departure board changes for station code\n"
+	"/v1/stats               -- cache memory use and evictions\n"
+	"/v1/page/XX[/NNNN]      -- saved upstream board page, or stops page of train NNNN,\n"
+	"                           for the cluster peers\n"
+	"\n"
+	"Add ?format=json to station, arrivals, departures and stats methods for JSON output.\n"
+	"Station and arrivals rows are filtered with ?window=minutes ahead and paged with &offset=n&limit=n.\n";
+
+/* reads a numeric query parameter, returns 0 if it's missing */
+static long
+api_param(const char *path, const char *name)
+{
+	const char *q = strchr(path, '?');
+	size_t len = strlen(name);
+
+	while (q != NULL) {
+		if (strncmp(q + 1, name, len) == 0 && q[len + 1] == '=')
+			return strtol(q + len + 2, NULL, 10);
+		q = strchr(q + 1, '&');
+	}
+
+	return 0;
+}
+
+/* parses up to MAX_ORIGINS comma separated origins, returns 0 if one is unknown */
+static size_t
+api_origins(char *s, station_id *from)
+{
+	char *code;
+	size_t n = 0;
+
+	while ((code = strsep(&s, ",")) != NULL) {
+		if (n == MAX_ORIGINS || (from[n] = station_find(code)) == STATION_NONE)
+			return 0;
+		n++;
+	}
+
+	return n;
+}
+
+/* rows go into the reply as the page is parsed, no board is built */
+static void
+api_station(station_id id, const char *path, enum report_format format, struct api_reply *r)
+{
+	struct board_filter filter = {
+		.offset = api_param(path, "offset"),
+		.limit = api_param(path, "limit"),
+		.window = api_param(path, "window"),
+		.now = clock_now(),
+	};
+
+	if (board_stream(id, format, &filter, &r->body) != 0) {
+		free(r->body.s);
+		memset(&r->body, 0, sizeof(struct buf));
+		r->status = 503;
+		report_error("Cannot get departures for", id, format, &r->body);
+	}
+}
+
+static void
+api_arrivals(station_id id, const char *path, enum report_format format, struct api_reply *r)
+{
+	struct station *st = board_get(id);
+	struct board_filter filter = {
+		.offset = api_param(path, "offset"),
+		.limit = api_param(path, "limit"),
+		.window = api_param(path, "window"),
+		.now = clock_now(),
+	};
+
+	/* trains leaving the station arrive there first */
+	if (st != NULL)
+		arrivals_index(st);
+	board_release(st);
+
+	arrivals_render(id, format, &filter, &r->body);
+}
+
+/* serves the saved upstream page to a peer, fetching it upstream if it is expired */
+static void
+api_page(const char *sid, const char *train, struct api_reply *r)
+{
+	char fname[PATH_MAX];
+	const char *text;
+	size_t len;
+	int rc;
+
+	if (train != NULL)
+		rc = train_page(sid, train, service_day(clock_now()), true, fname, sizeof(fname));
+	else
+		rc = board_page(sid, true, fname, sizeof(fname));
+
+	/* a stale page would pass for fresh on the peer, which has its own */
+	if (rc != 0 || expired(fname) || map_text(fname, &text, &len) != 0) {
+		r->status = 503;
+		return;
+	}
+
+	r->content_type = "text/html; charset=utf-8";
+	buf_append(&r->body, text, len);
+	unmap_text(text, len);
+}
+
+static void
+api_list(struct api_reply *r)
+{
+	char *s = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&s, &len);
+
+	if (f == NULL) {
+		r->status = 500;
+		return;
+	}
+
+	stations_list(f);
+	fclose(f);
+	buf_append(&r->body, s, len);
+	free(s);
+}
+
+static void
+api_stats(enum report_format format, struct api_reply *r)
+{
+	const char *names[MEM_CLASSES] = { "boards", "stops", "rendered" };
+	struct mem_stats s;
+	struct json j;
+	int c;
+
+	mem_stats_get(&s);
+
+	if (format == FORMAT_TEXT) {
+		buf_appendf(&r->body, "budget %zu\nused %zu\n", s.budget, s.used);
+		for (c = 0; c < MEM_CLASSES; c++) {
+			buf_appendf(&r->body, "%s entries %zu bytes %zu evictions %zu\n",
+				    names[c], s.entries[c], s.bytes[c], s.evictions[c]);
+		}
+		return;
+	}
+
+	json_init(&j, &r->body);
+	json_begin_object(&j);
+	json_key(&j, "budget");
+	json_int(&j, s.budget);
+	json_key(&j, "used");
+	json_int(&j, s.used);
+	for (c = 0; c < MEM_CLASSES; c++) {
+		json_key(&j, names[c]);
+		json_begin_object(&j);
+		json_key(&j, "entries");
+		json_int(&j, s.entries[c]);
+		json_key(&j, "bytes");
+		json_int(&j, s.bytes[c]);
+		json_key(&j, "evictions");
+		json_int(&j, s.evictions[c]);
+		json_end_object(&j);
+	}
+	json_end_object(&j);
+}
+
+/* picks the output format from a "format=json" query parameter */
+static enum report_format
+api_format(const char *path)
+{
+	enum report_format format = FORMAT_TEXT;
+	const char *q = strchr(path, '?');
+	char value[8];
+
+	while (q != NULL) {
+		if (sscanf(q + 1, "format=%7[^&]", value) == 1 && report_format_parse(value, &format) == 0)
+			break;
+		q = strchr(q + 1, '&');
+	}
+
+	return format;
+}
+
+void
+api_handle(const char *path, struct api_reply *r)
+{
+	char from[8 * MAX_ORIGINS], to[8], train[8];
+	station_id id, origins[MAX_ORIGINS];
+	size_t n;
+	enum report_format format = api_format(path);
+	struct trace_span span;
+
+	trace_begin(&span, "request", "api_handle");
+
+	memset(r, 0, sizeof(struct api_reply));
+	r->status = 200;
+	r->content_type = format == FORMAT_JSON ? "application/json" : "text/plain; charset=utf-8";
+
+	if (strcmp(path, "/v1/help") == 0 || strcmp(path, "/help") == 0) {
+		buf_append(&r->body, api_methods, strlen(api_methods));
+	} else if (strcmp(path, "/v1/version") == 0) {
+		buf_appendf(&r->body, "departures\nversion %s\ndate %s\n", app_version, app_date);
+	} else if (strcmp(path, "/v1/list") == 0) {
+		api_list(r);
+	} else if (strncmp(path, "/v1/stats", 9) == 0 && (path[9] == 0 || path[9] == '?')) {
+		api_stats(format, r);
+	} else if (sscanf(path, "/v1/station/%7[^/?]", from) == 1) {
+		id = station_find(from);
+		if (id != STATION_NONE)
+			api_station(id, path, format, r);
+		else
+			r->status = 404;
+	} else if (sscanf(path, "/v1/page/%7[^/?]/%7[0-9]", from, train) == 2) {
+		if (station_lookup(from) != STATION_NONE)
+			api_page(from, train, r);
+		else
+			r->status = 404;
+	} else if (sscanf(path, "/v1/page/%7[^/?]", from) == 1) {
+		if (station_lookup(from) != STATION_NONE)
+			api_page(from, NULL, r);
+		else
+			r->status = 404;
+	} else if (sscanf(path, "/v1/arrivals/%7[^/?]", from) == 1) {
+		id = station_find(from);
+		if (id != STATION_NONE)
+			api_arrivals(id, path, format, r);
+		else
+			r->status = 404;
+	} else if (sscanf(path, "/v1/departures/%31[^/]/%7[^/?]", from, to) == 2) {
+		n = api_origins(from, origins);
+		if (n == 0 || departures_render(origins, n, station_find(to), format, &r->body) != 0)
+			r->status = 404;
+	} else {
+		r->status = 404;
+	}
+
+	if (r->status == 404 && r->body.s == NULL)
+		buf_appendf(&r->body, "Not found: %s\n", path);
+
+	trace_end(&span, path, r->body.s != NULL ? strlen(r->body.s) : 0);
+}
+
+void
+api_reply_free(struct api_reply *r)
+{
+	free(r->body.s);
+	memset(r, 0, sizeof(struct api_reply));
+}
@@ -0,0 +1,9 @@
+struct api_reply
+{
+	int             status;         /* HTTP status code */
+	const char      *content_type;  /* MIME type of the body */
+	struct buf      body;           /* response body */
+};
+
+void api_handle(const char *path, struct api_reply *r);
+void api_reply_free(struct api_reply *r);
@@ -0,0 +1,590 @@
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "report.h"
+#include "render.h"
+#include "archive.h"
+#include "log.h"
+#include "util.h"
+
+#define ARCHIVE_LEVEL           9               /* zstd level of the frames */
+#define ARCHIVE_DICT            (112 * 1024)    /* bytes of a trained dictionary */
+#define ARCHIVE_SAMPLES         4096            /* pages a dictionary is trained on */
+#define ARCHIVE_SETTLE          5               /* seconds of fetches replayed before a report */
+#define MAX_DICTS               16              /* dictionaries read by one replay */
+
+/* one archived page */
+struct record
+{
+	time_t          fetched;        /* download time */
+	const char      *name;          /* file name in the page directory */
+	const char      *page;
+	size_t          len;
+};
+
+/* dictionaries of the frames read so far */
+struct dicts
+{
+	unsigned        id[MAX_DICTS];
+	ZSTD_DDict      *d[MAX_DICTS];
+	size_t          n;
+};
+
+static const char *archive_dir = NULL;
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static ZSTD_CCtx *cctx;                 /* under archive_lock */
+static ZSTD_CDict *cdict = NULL;        /* trained dictionary, NULL if none */
+static char segment[PATH_MAX];          /* open segment file */
+static int segment_fd = -1;
+
+/*
+ * Starts archiving the pages downloaded from upstream into dir. Returns -1
+ * if dir or its dictionary can't be read.
+ */
+int
+archive_open(const char *dir)
+{
+	char fname[PATH_MAX];
+	const char *dict;
+	size_t len;
+
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+		return -1;
+
+	cctx = ZSTD_createCCtx();
+	if (cctx == NULL)
+		err(1, "Cannot allocate compression context");
+
+	snprintf(fname, sizeof(fname), "%s/pages.dict", dir);
+	if (access(fname, R_OK) == 0 && map_text(fname, &dict, &len) == 0) {
+		if (len > 0)
+			cdict = ZSTD_createCDict(dict, len, ARCHIVE_LEVEL);
+		unmap_text(dict, len);
+		if (cdict == NULL)
+			return -1;
+	}
+
+	archive_dir = dir;
+
+	return 0;
+}
+
+/*
+ * Appends the page of fname, just downloaded into tmp, to the segment of
+ * the hour.
+ * A frame goes out in one write on an O_APPEND descriptor, so processes
+ * archiving into one directory don't interleave.
+ */
+void
+archive_page(const char *fname, const char *tmp)
+{
+	const char *page, *name;
+	char *src, *dst, path[PATH_MAX];
+	size_t len, hlen, bound, n;
+	time_t now = clock_now();
+	struct tm tm;
+
+	if (archive_dir == NULL || map_text(tmp, &page, &len) != 0)
+		return;
+
+	name = strrchr(fname, '/');
+	name = name != NULL ? name + 1 : fname;
+
+	src = malloc(PATH_MAX + 32 + len);
+	if (src == NULL)
+		err(1, "Cannot allocate archive record");
+
+	hlen = snprintf(src, PATH_MAX + 32, "%lld %s\n", (long long)now, name);
+	memcpy(src + hlen, page, len);
+	unmap_text(page, len);
+
+	bound = ZSTD_compressBound(hlen + len);
+	dst = malloc(bound);
+	if (dst == NULL)
+		err(1, "Cannot allocate archive frame");
+
+	localtime_r(&now, &tm);
+	snprintf(path, sizeof(path), "%s/pages-%04d%02d%02d-%02d.zst", archive_dir,
+		 tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour);
+
+	pthread_mutex_lock(&archive_lock);
+
+	if (cdict != NULL)
+		n = ZSTD_compress_usingCDict(cctx, dst, bound, src, hlen + len, cdict);
+	else
+		n = ZSTD_compressCCtx(cctx, dst, bound, src, hlen + len, ARCHIVE_LEVEL);
+
+	/* roll over to the segment of the next hour */
+	if (strcmp(path, segment) != 0) {
+		if (segment_fd >= 0)
+			close(segment_fd);
+		segment_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		snprintf(segment, sizeof(segment), "%s", path);
+	}
+
+	if (ZSTD_isError(n) || segment_fd < 0 || write(segment_fd, dst, n) != (ssize_t)n)
+		log_msg(LEVEL_WARN, "archive failed", name);
+
+	pthread_mutex_unlock(&archive_lock);
+
+	free(src);
+	free(dst);
+}
+
+/* returns the dictionary of the frames compressed with id, NULL if it can't be read */
+static ZSTD_DDict *
+dict_get(struct dicts *dicts, const char *dir, unsigned id)
+{
+	char fname[PATH_MAX];
+	const char *text;
+	ZSTD_DDict *d;
+	size_t i, len;
+
+	for (i = 0; i < dicts->n; i++)
+		if (dicts->id[i] == id)
+			return dicts->d[i];
+
+	snprintf(fname, sizeof(fname), "%s/dict-%u.dict", dir, id);
+	if (dicts->n == MAX_DICTS || map_text(fname, &text, &len) != 0)
+		return NULL;
+
+	d = len > 0 ? ZSTD_createDDict(text, len) : NULL;
+	unmap_text(text, len);
+	if (d == NULL)
+		return NULL;
+
+	dicts->id[dicts->n] = id;
+	dicts->d[dicts->n++] = d;
+
+	return d;
+}
+
+/*
+ * Calls fn for every page of the segment in order, until fn returns
+ * nonzero. A frame cut by a crashed writer ends the segment.
+ */
+static int
+segment_scan(const char *dir, const char *seg, struct dicts *dicts, ZSTD_DCtx *dctx,
+	     int (*fn)(void *arg, const struct record *r), void *arg, size_t *bytes)
+{
+	char fname[PATH_MAX], *out, *nl;
+	const char *text;
+	unsigned long long size;
+	size_t len, off, n, m;
+	unsigned id;
+	ZSTD_DDict *d;
+	struct record r;
+	long long t;
+	int rc = 0;
+
+	snprintf(fname, sizeof(fname), "%s/%s", dir, seg);
+	if (map_text(fname, &text, &len) != 0)
+		return -1;
+
+	*bytes += len;
+
+	for (off = 0; off < len && rc == 0; off += n) {
+		n = ZSTD_findFrameCompressedSize(text + off, len - off);
+		if (ZSTD_isError(n)) {
+			warnx("%s: cut frame at %zu", fname, off);
+			break;
+		}
+
+		size = ZSTD_getFrameContentSize(text + off, n);
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+			continue;
+
+		id = ZSTD_getDictID_fromFrame(text + off, n);
+		d = id != 0 ? dict_get(dicts, dir, id) : NULL;
+		if (id != 0 && d == NULL) {
+			warnx("%s: no dictionary %u", fname, id);
+			continue;
+		}
+
+		out = malloc(size + 1);
+		if (out == NULL)
+			err(1, "Cannot allocate page");
+
+		if (d != NULL)
+			m = ZSTD_decompress_usingDDict(dctx, out, size, text + off, n, d);
+		else
+			m = ZSTD_decompressDCtx(dctx, out, size, text + off, n);
+
+		nl = !ZSTD_isError(m) ? memchr(out, '\n', m) : NULL;
+		if (nl != NULL && sscanf(out, "%lld", &t) == 1 && strchr(out, ' ') < nl) {
+			*nl = 0;
+			r.fetched = t;
+			r.name = strchr(out, ' ') + 1;
+			r.page = nl + 1;
+			r.len = m - (nl + 1 - out);
+			rc = fn(arg, &r);
+		}
+
+		free(out);
+	}
+
+	unmap_text(text, len);
+
+	return rc;
+}
+
+static int
+is_segment(const struct dirent *e)
+{
+	size_t len = strlen(e->d_name);
+
+	return strncmp(e->d_name, "pages-", 6) == 0 && len > 4 && strcmp(e->d_name + len - 4, ".zst") == 0;
+}
+
+/*
+ * Calls fn for every archived page in fetch order, bytes gets the size of
+ * the segments. Returns -1 if dir can't be read.
+ */
+static int
+archive_scan(const char *dir, int (*fn)(void *arg, const struct record *r), void *arg, size_t *bytes)
+{
+	struct dirent **segs;
+	struct dicts dicts;
+	ZSTD_DCtx *dctx;
+	int n, i, rc = 0;
+
+	n = scandir(dir, &segs, is_segment, alphasort);
+	if (n < 0)
+		return -1;
+
+	dctx = ZSTD_createDCtx();
+	if (dctx == NULL)
+		err(1, "Cannot allocate decompression context");
+
+	memset(&dicts, 0, sizeof(struct dicts));
+	*bytes = 0;
+
+	for (i = 0; i < n; i++) {
+		if (rc == 0)
+			rc = segment_scan(dir, segs[i]->d_name, &dicts, dctx, fn, arg, bytes) > 0;
+		free(segs[i]);
+	}
+
+	free(segs);
+	while (dicts.n > 0)
+		ZSTD_freeDDict(dicts.d[--dicts.n]);
+	ZSTD_freeDCtx(dctx);
+
+	return 0;
+}
+
+/* ===== dictionary training ================= */
+
+struct samples
+{
+	char            *buf;           /* pages back to back */
+	size_t          len, cap;
+	size_t          sizes[ARCHIVE_SAMPLES];
+	unsigned        n;
+};
+
+static int
+sample_add(void *arg, const struct record *r)
+{
+	struct samples *s = arg;
+
+	if (s->len + r->len > s->cap) {
+		s->cap = (s->len + r->len) * 2;
+		s->buf = realloc(s->buf, s->cap);
+		if (s->buf == NULL)
+			err(1, "Cannot allocate samples");
+	}
+
+	memcpy(s->buf + s->len, r->page, r->len);
+	s->len += r->len;
+	s->sizes[s->n++] = r->len;
+
+	return s->n == ARCHIVE_SAMPLES;
+}
+
+/* adds the saved pages of a page directory */
+static void
+samples_read(struct samples *s, const char *dir)
+{
+	char fname[PATH_MAX];
+	struct dirent *e;
+	struct record r;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL)
+		err(1, "Cannot open %s", dir);
+
+	while (s->n < ARCHIVE_SAMPLES && (e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, "njtransit-", 10) != 0 || strstr(e->d_name, ".html") == NULL)
+			continue;
+
+		snprintf(fname, sizeof(fname), "%s/%s", dir, e->d_name);
+		if (map_text(fname, &r.page, &r.len) != 0)
+			continue;
+		if (r.len > 0)
+			sample_add(s, &r);
+		unmap_text(r.page, r.len);
+	}
+
+	closedir(d);
+}
+
+/*
+ * Trains the dictionary of the archive in dir on the pages archived so
+ * far and the pages saved in page_dirs, and makes it the one new frames
+ * are compressed with.
+ */
+int
+archive_train(const char *dir, char *const *page_dirs, int n)
+{
+	struct samples *s;
+	char fname[PATH_MAX], tmp[PATH_MAX], link[32];
+	size_t bytes, size;
+	unsigned id;
+	void *dict;
+	FILE *f;
+	int i;
+
+	s = calloc(1, sizeof(struct samples));
+	if (s == NULL)
+		err(1, "Cannot allocate samples");
+
+	if (archive_scan(dir, sample_add, s, &bytes) != 0)
+		err(1, "Cannot read archive %s", dir);
+
+	for (i = 0; i < n && s->n < ARCHIVE_SAMPLES; i++)
+		samples_read(s, page_dirs[i]);
+
+	if (s->n < 8)
+		errx(1, "Too few pages to train a dictionary: %u", s->n);
+
+	dict = malloc(ARCHIVE_DICT);
+	if (dict == NULL)
+		err(1, "Cannot allocate dictionary");
+
+	size = ZDICT_trainFromBuffer(dict, ARCHIVE_DICT, s->buf, s->sizes, s->n);
+	if (ZDICT_isError(size))
+		errx(1, "Cannot train dictionary: %s", ZDICT_getErrorName(size));
+
+	id = ZDICT_getDictID(dict, size);
+	snprintf(link, sizeof(link), "dict-%u.dict", id);
+	snprintf(fname, sizeof(fname), "%s/%s", dir, link);
+
+	f = fopen(fname, "wb");
+	if (f == NULL || fwrite(dict, 1, size, f) != size || fclose(f) != 0)
+		err(1, "Cannot write %s", fname);
+
+	/* swap the link, a running archiver keeps its dictionary until restarted */
+	snprintf(tmp, sizeof(tmp), "%s/pages.dict.tmp", dir);
+	snprintf(fname, sizeof(fname), "%s/pages.dict", dir);
+	unlink(tmp);
+	if (symlink(link, tmp) != 0 || rename(tmp, fname) != 0)
+		err(1, "Cannot link %s", fname);
+
+	printf("dictionary %u, %zu bytes from %u pages\n", id, size, s->n);
+
+	free(dict);
+	free(s->buf);
+	free(s);
+
+	return 0;
+}
+
+/* ===== replay ==============================
+ *
+ * Pages are written into a scratch page directory with their fetch time
+ * as mtime, and the clock is set to it. A report on the origins runs
+ * ARCHIVE_SETTLE seconds of fetches after their board, so the stops pages
+ * fetched for the original report are in place; without origins every
+ * board is rendered as soon as it is played.
+ */
+
+struct replay
+{
+	double          speed;          /* times faster than recorded, 0 for no waits */
+	const station_id *from;
+	size_t          n_from;
+	station_id      to;
+	enum report_format format;
+	struct board_filter filter;
+	time_t          last;           /* fetch time of the previous page */
+	time_t          pending;        /* fetch time of the board to report on, 0 if none */
+	station_id      board;          /* board to render without origins */
+	size_t          pages, bytes, reports;
+};
+
+static void
+replay_report(struct replay *rp)
+{
+	struct station *st;
+	struct buf b;
+	struct tm tm;
+
+	memset(&b, 0, sizeof(struct buf));
+	clock_replay(rp->pending);
+	localtime_r(&rp->pending, &tm);
+
+	if (rp->n_from > 0) {
+		departures_render(rp->from, rp->n_from, rp->to, rp->format, &b);
+	} else {
+		st = board_get(rp->board);
+		if (st != NULL) {
+			rp->filter.now = rp->pending;
+			board_render(st, rp->format, &rp->filter, &b);
+			board_release(st);
+		}
+	}
+
+	printf("# %02d:%02d:%02d\n%s%s", tm.tm_hour, tm.tm_min, tm.tm_sec,
+	       b.s != NULL ? b.s : "", rp->format == FORMAT_JSON ? "\n" : "");
+	free(b.s);
+
+	rp->reports++;
+	rp->pending = 0;
+}
+
+static int
+replay_page(void *arg, const struct record *r)
+{
+	struct replay *rp = arg;
+	char fname[PATH_MAX], tmp[PATH_MAX], code[3];
+	struct timespec wait, times[2];
+	station_id id;
+	size_t i;
+	int fd;
+
+	if (strchr(r->name, '/') != NULL)
+		return 0;
+
+	if (rp->speed > 0 && rp->last != 0 && r->fetched > rp->last) {
+		double sec = (r->fetched - rp->last) / rp->speed;
+		wait.tv_sec = sec;
+		wait.tv_nsec = (sec - wait.tv_sec) * 1e9;
+		nanosleep(&wait, NULL);
+	}
+
+	if (rp->pending != 0 && r->fetched > rp->pending + ARCHIVE_SETTLE)
+		replay_report(rp);
+
+	rp->last = r->fetched;
+	clock_replay(r->fetched);
+
+	snprintf(fname, sizeof(fname), "%s/%s", page_dir, r->name);
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", fname) >= (int)sizeof(tmp))
+		errx(1, "Page name too long %s", fname);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		err(1, "Cannot create %s", tmp);
+
+	times[0].tv_sec = times[1].tv_sec = r->fetched;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	if (write(fd, r->page, r->len) != (ssize_t)r->len || futimens(fd, times) != 0 ||
+	    close(fd) != 0 || rename(tmp, fname) != 0)
+		err(1, "Cannot write %s", fname);
+
+	rp->pages++;
+	rp->bytes += r->len;
+
+	if (sscanf(r->name, "njtransit-%2[A-Z0-9].html", code) != 1 ||
+	    (id = station_lookup(code)) == STATION_NONE)
+		return 0;
+
+	if (rp->n_from == 0) {
+		rp->pending = r->fetched;
+		rp->board = id;
+		replay_report(rp);
+		return 0;
+	}
+
+	for (i = 0; i < rp->n_from; i++)
+		if (rp->from[i] == id && rp->pending == 0)
+			rp->pending = r->fetched;
+
+	return 0;
+}
+
+/* removes the scratch page directory */
+static void
+replay_clean(const char *dir)
+{
+	char fname[PATH_MAX];
+	struct dirent *e;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return;
+
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(fname, sizeof(fname), "%s/%s", dir, e->d_name);
+		unlink(fname);
+	}
+
+	closedir(d);
+	rmdir(dir);
+}
+
+/*
+ * Replays the archive in dir, writing the report from the origins to to,
+ * or every board if there are no origins, each time it would have been
+ * made. Waits are shortened speed times, none if it is 0.
+ */
+int
+archive_replay(const char *dir, double speed, const station_id *from, size_t n_from,
+	       station_id to, enum report_format format, const struct board_filter *filter)
+{
+	char scratch[] = "/tmp/departures-replay-XXXXXX";
+	struct replay rp;
+	struct timespec start, end;
+	size_t archived;
+
+	memset(&rp, 0, sizeof(struct replay));
+	rp.speed = speed;
+	rp.from = from;
+	rp.n_from = n_from;
+	rp.to = to;
+	rp.format = format;
+	rp.filter = *filter;
+
+	if (mkdtemp(scratch) == NULL)
+		err(1, "Cannot create %s", scratch);
+
+	page_dir = scratch;
+	upstream_offline();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (archive_scan(dir, replay_page, &rp, &archived) != 0)
+		err(1, "Cannot read archive %s", dir);
+
+	if (rp.pending != 0)
+		replay_report(&rp);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	clock_replay(0);
+	replay_clean(scratch);
+
+	fprintf(stderr, "pages %zu, %zu bytes from %zu archived, reports %zu, time %.3f s\n",
+		rp.pages, rp.bytes, archived, rp.reports,
+		end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	return rp.pages > 0 ? 0 : 1;
+}
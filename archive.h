@@ -0,0 +1,22 @@
+/*
+ * Archive of the upstream pages.
+ *
+ * With -Z dir every page downloaded from upstream is appended to the
+ * segment of the hour, dir/pages-YYYYMMDD-HH.zst, as one zstd frame of a
+ * "fetched name" line and the page. The pages are near-identical HTML, so
+ * frames are compressed with the dictionary dir/pages.dict once one has
+ * been trained with -K. Each frame names its dictionary, which is kept
+ * as dir/dict-ID.dict, so retraining doesn't strand older segments.
+ *
+ * -Y dir replays the archive in fetch order through the page cache,
+ * parser and reports, with the clock set to the fetch times and upstream
+ * disabled, so a replay gives the same reports on every run.
+ */
+
+#include <stddef.h>
+
+int archive_open(const char *dir);
+void archive_page(const char *fname, const char *tmp);
+int archive_train(const char *dir, char *const *page_dirs, int n);
+int archive_replay(const char *dir, double speed, const station_id *from, size_t n_from,
+		   station_id to, enum report_format format, const struct board_filter *filter);
@@ -0,0 +1,352 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "report.h"
+#include "arrivals.h"
+#include "json.h"
+#include "trace.h"
+#include "log.h"
+#include "util.h"
+
+#define ARRIVALS_TRAINS         8       /* next trains of a board followed to their stops */
+#define ARRIVALS_LOOKBACK       3600    /* seconds a late train may stay on a board */
+#define ARRIVALS_PAST           60      /* seconds an arrival is shown after its ETA */
+
+struct arrival
+{
+	char            train[8];       /* train number */
+	time_t          eta;            /* expected arrival */
+	station_id      origin;         /* first stop of the train */
+	station_id      src;            /* board the arrival was indexed from */
+	size_t          ref;            /* its slot in the board's added list */
+};
+
+/* arrivals at one station in no particular order */
+struct arrivals
+{
+	struct arrival  *a;
+	size_t          n, cap;
+};
+
+/* where an arrival added by a board is kept */
+struct slot
+{
+	station_id      id;             /* station of the arrival */
+	size_t          idx;            /* index in its arrivals */
+};
+
+/* arrivals added by one board */
+struct added
+{
+	struct slot     *s;
+	size_t          n, cap;
+};
+
+static struct arrivals at[STATION_NONE];
+static struct added added[STATION_NONE];
+static uint64_t indexed[STATION_NONE];         /* board version indexed per station */
+static bool pending[STATION_NONE];             /* boards loaded but not indexed yet */
+static atomic_bool running;                    /* the indexing thread is started */
+static pthread_mutex_t arrivals_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arrivals_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+arrival_add(station_id id, const char *train, time_t eta, station_id origin, station_id src)
+{
+	struct arrivals *l = &at[id];
+	struct added *ad = &added[src];
+	struct arrival *a;
+
+	if (l->n == l->cap) {
+		l->cap = l->cap == 0 ? 16 : l->cap * 2;
+		l->a = realloc(l->a, l->cap * sizeof(struct arrival));
+		if (l->a == NULL)
+			err(1, "Cannot allocate arrivals");
+	}
+
+	if (ad->n == ad->cap) {
+		ad->cap = ad->cap == 0 ? 16 : ad->cap * 2;
+		ad->s = realloc(ad->s, ad->cap * sizeof(struct slot));
+		if (ad->s == NULL)
+			err(1, "Cannot allocate arrivals");
+	}
+
+	ad->s[ad->n].id = id;
+	ad->s[ad->n].idx = l->n;
+
+	a = &l->a[l->n++];
+	snprintf(a->train, sizeof(a->train), "%s", train);
+	a->eta = eta;
+	a->origin = origin;
+	a->src = src;
+	a->ref = ad->n++;
+}
+
+/*
+ * Drops what an older version of the board added, moving the last arrival
+ * of a station into each freed slot and pointing its board's list at it.
+ */
+static void
+arrivals_forget(station_id src)
+{
+	struct added *ad = &added[src];
+	struct arrivals *l;
+	struct arrival *last;
+	size_t i, idx;
+
+	for (i = 0; i < ad->n; i++) {
+		l = &at[ad->s[i].id];
+		idx = ad->s[i].idx;
+		last = &l->a[--l->n];
+		if (last != &l->a[idx]) {
+			l->a[idx] = *last;
+			added[last->src].s[last->ref].idx = idx;
+		}
+	}
+
+	ad->n = 0;
+}
+
+/*
+ * Stop status is "at 7:22" for scheduled stops or "in 5 Min" for the next
+ * ones, counted from loaded, when the stops page was parsed.
+ */
+static time_t
+stop_eta(const char *status, time_t loaded)
+{
+	int min;
+
+	if (status == NULL)
+		return -1;
+
+	while (*status == ' ')
+		status++;
+
+	if (strncmp(status, "at ", 3) == 0)
+		return clock_time(status + 3, loaded - ARRIVALS_LOOKBACK);
+
+	if (sscanf(status, "in %d Min", &min) == 1)
+		return loaded + min * 60;
+
+	return -1;
+}
+
+/*
+ * Indexes the next trains of the board unless this version of it is
+ * already indexed. The stop lists are fetched without holding the lock.
+ */
+void
+arrivals_index(const struct station *st)
+{
+	struct train_stops *ts[ARRIVALS_TRAINS];
+	struct departure *dep;
+	struct trace_span span;
+	time_t eta;
+	size_t n = 0, i, s;
+
+	pthread_mutex_lock(&arrivals_lock);
+	if (indexed[st->id] == st->version) {
+		pthread_mutex_unlock(&arrivals_lock);
+		return;
+	}
+	pthread_mutex_unlock(&arrivals_lock);
+
+	trace_begin(&span, "arrivals", "arrivals_index");
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		if (n == ARRIVALS_TRAINS)
+			break;
+		ts[n] = get_prev_stations(st->id, dep->train);
+		if (ts[n] != NULL)
+			n++;
+	}
+
+	pthread_mutex_lock(&arrivals_lock);
+
+	/* a newer version may have been indexed meanwhile */
+	if (indexed[st->id] < st->version) {
+		arrivals_forget(st->id);
+
+		for (i = 0; i < n; i++) {
+			for (s = 1; s < ts[i]->n; s++) {
+				eta = stop_eta(ts[i]->stops[s].status, ts[i]->loaded);
+				if (ts[i]->stops[s].id != STATION_NONE && eta >= 0)
+					arrival_add(ts[i]->stops[s].id, ts[i]->train, eta, ts[i]->stops[0].id, st->id);
+			}
+		}
+
+		indexed[st->id] = st->version;
+	}
+
+	pthread_mutex_unlock(&arrivals_lock);
+
+	for (i = 0; i < n; i++)
+		train_stops_release(ts[i]);
+
+	trace_end(&span, station_code(st->id), 0);
+
+	log_num(LEVEL_INFO, "arrivals indexed trains", station_code(st->id), n);
+}
+
+static void *
+arrivals_loop(void *arg)
+{
+	struct station *st;
+	station_id id;
+
+	for (;;) {
+		pthread_mutex_lock(&arrivals_lock);
+		for (;;) {
+			for (id = 0; id < STATION_NONE && !pending[id]; id++)
+				;
+			if (id < STATION_NONE)
+				break;
+			pthread_cond_wait(&arrivals_cond, &arrivals_lock);
+		}
+		pending[id] = false;
+		pthread_mutex_unlock(&arrivals_lock);
+
+		st = board_get(id);
+		if (st != NULL) {
+			arrivals_index(st);
+			board_release(st);
+		}
+	}
+
+	return NULL;
+}
+
+/* indexes every board loaded from now on, on a thread next to the API server */
+void
+arrivals_start()
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, arrivals_loop, NULL) != 0)
+		errx(1, "Cannot create arrivals thread");
+
+	pthread_detach(thread);
+	atomic_store(&running, true);
+}
+
+/* called when a new board version is published */
+void
+arrivals_board_loaded(station_id id)
+{
+	if (!atomic_load_explicit(&running, memory_order_relaxed))
+		return;
+
+	pthread_mutex_lock(&arrivals_lock);
+	pending[id] = true;
+	pthread_cond_signal(&arrivals_cond);
+	pthread_mutex_unlock(&arrivals_lock);
+}
+
+static int
+compare_eta(const void *v1, const void *v2)
+{
+	const struct arrival *a1 = v1;
+	const struct arrival *a2 = v2;
+
+	if (a1->eta != a2->eta)
+		return a1->eta < a2->eta ? -1 : 1;
+
+	return strcmp(a1->train, a2->train);
+}
+
+/*
+ * Appends the arrivals at the station ordered by ETA to b. A train indexed
+ * from several boards is shown once.
+ */
+void
+arrivals_render(station_id id, enum report_format format, const struct board_filter *filter,
+		struct buf *b)
+{
+	struct arrival *a = NULL;
+	size_t n, i, k, seen = 0, shown = 0;
+	time_t now = filter->now;
+	struct json j;
+	struct tm tm;
+	char clock[8];
+
+	pthread_mutex_lock(&arrivals_lock);
+	n = at[id].n;
+	if (n > 0) {
+		a = malloc(n * sizeof(struct arrival));
+		if (a == NULL)
+			err(1, "Cannot allocate arrivals");
+		memcpy(a, at[id].a, n * sizeof(struct arrival));
+	}
+	pthread_mutex_unlock(&arrivals_lock);
+
+	qsort(a, n, sizeof(struct arrival), compare_eta);
+
+	json_init(&j, b);
+	if (format == FORMAT_JSON) {
+		json_begin_object(&j);
+		json_key(&j, "station");
+		json_begin_object(&j);
+		json_key(&j, "code");
+		json_string(&j, station_code(id));
+		json_key(&j, "name");
+		json_string(&j, station_name(id));
+		json_end_object(&j);
+		json_key(&j, "arrivals");
+		json_begin_array(&j);
+	} else {
+		buf_appendf(b, "Arrivals at %s(%s)\n", station_name(id), station_code(id));
+	}
+
+	for (i = 0; i < n; i++) {
+		if (a[i].eta + ARRIVALS_PAST < now)
+			continue;
+		for (k = 0; k < i && strcmp(a[k].train, a[i].train) != 0; k++)
+			;
+		if (k < i)
+			continue;
+		if (filter->window > 0 && a[i].eta > now + filter->window * 60)
+			break;
+		if (filter->limit > 0 && shown == filter->limit)
+			break;
+		if (seen++ < filter->offset)
+			continue;
+
+		shown++;
+
+		localtime_r(&a[i].eta, &tm);
+		snprintf(clock, sizeof(clock), "%d:%02d", tm.tm_hour % 12 == 0 ? 12 : tm.tm_hour % 12, tm.tm_min);
+
+		if (format == FORMAT_JSON) {
+			json_begin_object(&j);
+			json_key(&j, "time");
+			json_string(&j, clock);
+			json_key(&j, "train");
+			json_string(&j, a[i].train);
+			json_key(&j, "from");
+			json_string(&j, station_code(a[i].origin));
+			json_key(&j, "origin");
+			json_string(&j, station_name(a[i].origin));
+			json_end_object(&j);
+		} else {
+			buf_appendf(b, "%7s %5s %-2s %s\n", clock, a[i].train,
+				    a[i].origin != STATION_NONE ? station_code(a[i].origin) : "",
+				    a[i].origin != STATION_NONE ? station_name(a[i].origin) : "");
+		}
+	}
+
+	if (format == FORMAT_JSON) {
+		json_end_array(&j);
+		json_end_object(&j);
+	}
+
+	free(a);
+}
@@ -0,0 +1,20 @@
+/*
+ * Arrivals index. A board is indexed by following its next trains through
+ * their stop lists and adding the ETA of every stop still ahead of them to
+ * the arrivals of that stop. Indexing a newer version of a board replaces
+ * what the old one added, so the index is kept up to date one board at a
+ * time and a query only sorts the arrivals of its station.
+ *
+ * The API server indexes every board it loads on a background thread; the
+ * CLI indexes the boards of the stations it is given.
+ */
+
+struct buf;
+struct station;
+struct board_filter;
+
+void arrivals_start(void);
+void arrivals_board_loaded(station_id id);
+void arrivals_index(const struct station *st);
+void arrivals_render(station_id id, enum report_format format, const struct board_filter *filter,
+		     struct buf *b);
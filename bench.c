@@ -0,0 +1,118 @@
+#include <dirent.h>
+#include <err.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stations.h"
+#include "board.h"
+#include "bench.h"
+
+#define MAX_PAGES       256
+
+struct page
+{
+	char            fname[PATH_MAX];
+	station_id      id;             /* board station, STATION_NONE for train stops */
+};
+
+static size_t
+pages_find(const char *dir, struct page *pages, size_t n, size_t max)
+{
+	char code[3];
+	struct dirent *e;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL)
+		err(1, "Cannot open %s", dir);
+
+	while (n < max && (e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, "njtransit-", 10) != 0 || strstr(e->d_name, ".html") == NULL)
+			continue;
+
+		if (strncmp(e->d_name, "njtransit-train-", 16) == 0) {
+			pages[n].id = STATION_NONE;
+		} else {
+			if (sscanf(e->d_name, "njtransit-%2[A-Z0-9].html", code) != 1)
+				continue;
+			pages[n].id = station_lookup(code);
+			if (pages[n].id == STATION_NONE)
+				continue;
+		}
+
+		snprintf(pages[n].fname, sizeof(pages[n].fname), "%s/%s", dir, e->d_name);
+		n++;
+	}
+
+	closedir(d);
+
+	return n;
+}
+
+static double
+now_sec()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+bench_run(char *const *dirs, int n, int rounds)
+{
+	struct page *pages;
+	struct station *st;
+	struct train_stops *ts;
+	size_t n_pages = 0, rows = 0, stops = 0, lookups = 0, i;
+	double start, elapsed;
+	int d, r;
+
+	pages = calloc(MAX_PAGES, sizeof(struct page));
+	if (pages == NULL)
+		err(1, "Cannot allocate pages");
+
+	for (d = 0; d < n; d++)
+		n_pages = pages_find(dirs[d], pages, n_pages, MAX_PAGES);
+
+	if (n_pages == 0)
+		errx(1, "No pages found");
+
+	start = now_sec();
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < n_pages; i++) {
+			if (pages[i].id == STATION_NONE) {
+				ts = train_stops_parse(pages[i].fname);
+				if (ts == NULL)
+					errx(1, "Cannot read %s", pages[i].fname);
+				stops += ts->n;
+				train_stops_release(ts);
+			} else {
+				st = station_parse(pages[i].id, pages[i].fname);
+				if (st == NULL)
+					errx(1, "Cannot read %s", pages[i].fname);
+				rows += st->deps->size;
+				board_release(st);
+			}
+		}
+
+		for (i = 0; i < n_stations; i++) {
+			if (station_find(station_defs[i].code) != i || station_find(station_defs[i].name) != i)
+				errx(1, "Lookup of %s failed", station_defs[i].code);
+			lookups += 2;
+		}
+	}
+
+	elapsed = now_sec() - start;
+
+	printf("pages %zu rounds %d rows %zu stops %zu lookups %zu\n", n_pages, rounds, rows, stops, lookups);
+	printf("time %.3f s, %.3f ms per round\n", elapsed, elapsed * 1000 / rounds);
+
+	free(pages);
+
+	return 0;
+}
@@ -0,0 +1,10 @@
+/*
+ * Parser and lookup benchmark.
+ *
+ * Parses every saved board and train stops page in the given directories
+ * and looks up every station by code and name, rounds times, without any
+ * network I/O. It is the training workload of the PGO build and the
+ * workload bench.sh compares between builds.
+ */
+
+int bench_run(char *const *dirs, int n, int rounds);
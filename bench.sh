@@ -0,0 +1,37 @@
+#!/bin/bash
+# usage: bench.sh baseline [departures ...]
+#
+# Runs the parser and lookup benchmark of every binary over the captured
+# pages in tests/ and compares the best time per round with the first
+# one. ROUNDS and RUNS override the rounds per run and runs per binary.
+
+SRCDIR=$(cd $(dirname $0); pwd)
+ROUNDS=${ROUNDS:-200}
+RUNS=${RUNS:-5}
+PAGES="$SRCDIR/tests/01 $SRCDIR/tests/02 $SRCDIR/tests/03"
+
+if [[ $# == 0 ]] ; then
+	echo usage: bench.sh baseline [departures ...]
+	exit 1
+fi
+
+base=
+
+for bin in "$@" ; do
+	if [[ ! -x $bin ]] ; then
+		echo "$bin: not built"
+		continue
+	fi
+
+	best=
+	for i in $(seq $RUNS) ; do
+		ms=$($bin -B $ROUNDS $PAGES | awk '/per round/ { print $4 }')
+		if [[ -z $best ]] || awk "BEGIN { exit !($ms < $best) }" ; then
+			best=$ms
+		fi
+	done
+
+	[[ -z $base ]] && base=$best
+	awk -v bin="$bin" -v ms=$best -v base=$base \
+		'BEGIN { printf "%-60s %8.3f ms per round  %5.2fx\n", bin, ms, base / ms }'
+done
@@ -0,0 +1,1177 @@
+#include <err.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "parser.h"
+#include "util.h"
+#include "color.h"
+#include "flight.h"
+#include "rcu.h"
+#include "mem.h"
+#include "shm.h"
+#include "schedule.h"
+#include "report.h"
+#include "arrivals.h"
+#include "cluster.h"
+#include "trace.h"
+#include "log.h"
+
+static void
+departure_dump(struct departure *d)
+{
+	const char *code = station_code(d->dest);
+
+	printf(COL_TIME COL_TRAIN "%s " COL_DEST COL_TRACK "%s\n",
+		d->time, d->train, code != NULL ? code : "SC", d->destination,
+		d->track, d->status);
+}
+
+/*
+ * Parses a board row into dep, copying its fields into strings. Returns -1
+ * for header and banner rows and for malformed rows, which are skipped so
+ * one bad row doesn't lose the rest of the board.
+ */
+static int
+parse_tr(const char *text, int len, struct strpool *strings, struct departure *dep)
+{
+	static const char *const fields[] = {"time", "destination", "track", "line", "train"};
+	const char *cell[6];
+	size_t cell_len[6];
+	int i, n;
+
+	if (strnstr(text, " Departures", len) != NULL)
+		return -1;
+
+	struct trscanner scan;
+
+	trscanner_create(&scan, text, len);
+	memset(dep, 0, sizeof(struct departure));
+
+	for (n = 0; n < 6 && trscanner_next(&scan); n++) {
+		cell[n] = scan.sbeg;
+		cell_len[n] = scan.mlen;
+
+		/* header and banner rows */
+		if (n == 0 && (cell_len[0] == 0 || strncmp("DEP", cell[0], 3) == 0)) {
+			trscanner_destroy(&scan);
+			return -1;
+		}
+	}
+
+	trscanner_destroy(&scan);
+
+	if (n < 5) {
+		log_text(LEVEL_DEBUG, "skipped row without", fields[n], text, len);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		if (i == 2 && cell_len[i] == 6 && strncmp("Single", cell[i], 6) == 0)
+			cell[i] = strpool_add(strings, "1", 1);
+		else
+			cell[i] = strpool_add(strings, cell[i], cell_len[i]);
+
+	dep->time = (char *)cell[0];
+	dep->destination = (char *)cell[1];
+	dep->track = (char *)cell[2];
+	dep->line = (char *)cell[3];
+	dep->train = (char *)cell[4];
+	if (n == 6)
+		dep->status = (char *)cell[5];
+
+	dep->dest = station_by_name(dep->destination);
+	if (dep->dest != STATION_NONE)
+		dep->destination = (char *)station_name(dep->dest);
+	else
+		log_text(LEVEL_DEBUG, "no code for destination", NULL, dep->destination, strlen(dep->destination));
+
+	return 0;
+}
+
+/*
+ * Parses the board page text of the station row by row and calls fn for
+ * every departure as soon as its row is parsed, joined with its timetable
+ * departure. The fields are copied into strings, or into a scratch pool
+ * reused for every row when strings is NULL, in which case the departure
+ * is only valid during the call. fn returns nonzero to stop the scan.
+ */
+static void
+board_scan(station_id id, const char *text, size_t len, struct strpool *strings,
+	int (*fn)(void *arg, struct departure *dep), void *arg)
+{
+	struct strpool scratch = {0};
+	int rc;
+	regex_t p1, p2;
+	regmatch_t m1, m2;
+	struct departure dep;
+	time_t now = clock_now();
+
+	rc = regcomp(&p1, "<tr[^>]*>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p1);
+
+	rc = regcomp(&p2, "</tr>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p2);
+
+	m1.rm_so = 0;
+	m1.rm_eo = len;
+
+	for (;;)
+	{
+		rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
+
+		if (rc == REG_NOMATCH)
+			break;
+
+		if (rc != 0)
+			print_rex_error(rc, &p1);
+
+		m2.rm_so = m1.rm_eo;
+		m2.rm_eo = len;
+
+		rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
+
+		if (rc == REG_NOMATCH)
+			break;
+
+		if (rc != 0)
+			print_rex_error(rc, &p2);
+
+		log_text(LEVEL_DEBUG, "tr", station_code(id), &text[m1.rm_eo], m2.rm_so - m1.rm_eo);
+
+		if (parse_tr(&text[m1.rm_eo], m2.rm_so - m1.rm_eo, strings != NULL ? strings : &scratch, &dep) == 0) {
+			dep.scheduled = schedule_departure(dep.train, id, now);
+			if (fn(arg, &dep) != 0)
+				break;
+		}
+
+		if (strings == NULL)
+			strpool_reset(&scratch);
+
+		m1.rm_so = m2.rm_eo;
+		m1.rm_eo = len;
+	}
+
+	regfree(&p1);
+	regfree(&p2);
+	strpool_free(&scratch);
+}
+
+struct board_append
+{
+	struct departures       *deps;          /* board departures */
+	struct departure        *last;          /* last appended departure */
+};
+
+static int
+board_append(void *arg, struct departure *parsed)
+{
+	struct board_append *a = arg;
+	struct departure *dep = malloc(sizeof(struct departure));
+
+	if (dep == NULL)
+		err(1, "Cannot allocate departure");
+
+	*dep = *parsed;
+
+	if (a->last == NULL)
+		SLIST_INSERT_HEAD(a->deps->list, dep, entries);
+	else
+		SLIST_INSERT_AFTER(a->last, dep, entries);
+
+	a->deps->size++;
+	a->last = dep;
+
+	return 0;
+}
+
+static int
+station_load(struct station* st, const char *fname)
+{
+	const char *text;
+	size_t len;
+	struct board_append a;
+	struct trace_span span;
+
+	if (map_text(fname, &text, &len) != 0)
+		return -1;
+
+	trace_begin(&span, "parse", "station_load");
+
+	st->text = calloc(1, sizeof(struct strpool));
+	if (st->text == NULL)
+		err(1, "Cannot allocate strings");
+
+	st->deps = calloc(1, sizeof(struct departures));
+	if (st->deps == NULL)
+		err(1, "Cannot allocate deps");
+
+	st->deps->list = calloc(1, sizeof(struct departure_list));
+	SLIST_INIT(st->deps->list);
+
+	log_num(LEVEL_DEBUG, "read bytes", station_code(st->id), len);
+
+	a.deps = st->deps;
+	a.last = NULL;
+	board_scan(st->id, text, len, st->text, board_append, &a);
+	unmap_text(text, len);
+	trace_end(&span, station_code(st->id), len);
+
+	st->bytes = sizeof(struct station) + sizeof(struct departures) + sizeof(struct departure_list) +
+		    st->deps->size * sizeof(struct departure) + sizeof(struct strpool) + st->text->bytes;
+	st->loaded = clock_now();
+
+	return 0;
+}
+
+/*
+ * Parses a saved board page of the station into an unpublished board.
+ * Returns NULL if the page can't be read.
+ */
+struct station *
+station_parse(station_id id, const char *fname)
+{
+	struct station *st = calloc(1, sizeof(struct station));
+	if (st == NULL)
+		err(1, "Cannot allocate station");
+
+	st->id = id;
+	atomic_init(&st->refs, 1);
+	if (station_load(st, fname) != 0) {
+		free(st);
+		return NULL;
+	}
+	mem_charge(MEM_BOARDS, st->bytes);
+
+	return st;
+}
+
+const char *page_dir = "/tmp";          /* directory of the saved pages */
+
+static const char *board_url = "http://dv.njtransit.com/mobile/tid-mobile.aspx?SID=%s&SORT=A";
+static const char *train_url = "http://dv.njtransit.com/mobile/train_stops.aspx?sid=%s&train=%s%s";
+
+/* Fetches the pages from the debug server, tests/server.py serving a tests/NN directory. */
+void
+use_debug_server()
+{
+	board_url = "http://localhost:8000/njtransit-%s.html";
+	/* the test pages are named by the train number without padding */
+	train_url = "http://localhost:8000/njtransit-train-%s-%.0s%s.html";
+}
+
+/*
+ * Refreshes a page from the cluster node owning key, or from upstream if
+ * the owner can't be reached. An owner that couldn't get the page has
+ * already tried upstream, so the stale page is used if there is one.
+ */
+static int
+page_fetch(const char *key, const char *path, const char *url, const char *fname, bool local)
+{
+	const char *peer = local ? NULL : cluster_owner(key);
+	char peer_url[128];
+	struct trace_span span;
+	int rc;
+
+	trace_begin(&span, "fetch", "page_fetch");
+
+	if (peer != NULL) {
+		snprintf(peer_url, sizeof(peer_url), "http://%s%s", peer, path);
+		rc = fetch_peer(peer_url, fname);
+		if (rc >= 0) {
+			rc = rc == 0 || access(fname, R_OK) == 0 ? 0 : -1;
+			goto out;
+		}
+		log_msg(LEVEL_WARN, "peer unreachable, going upstream", peer);
+	}
+
+	rc = fetch_page(url, fname);
+
+out:
+	trace_end(&span, key, 0);
+
+	return rc;
+}
+
+/*
+ * Refreshes the board page of the station if expired, fname gets its cache
+ * file. The page is fetched from upstream when local is set, otherwise
+ * from the cluster node owning the station.
+ */
+int
+board_page(const char *sid, bool local, char *fname, size_t sz)
+{
+	char url[100], path[32];
+
+	snprintf(fname, sz, "%s/njtransit-%s.html", page_dir, sid);
+	snprintf(url, sizeof(url), board_url, sid);
+	snprintf(path, sizeof(path), "/v1/page/%s", sid);
+
+	if (debug && expired(fname))
+		fprintf(stderr, "httpreq: %s, dest: %s\n", url, fname);
+
+	if (debug)
+		return 0;
+
+	return page_fetch(sid, path, url, fname, local);
+}
+
+/* Same for the stops page of the train asked for from the station on the service day. */
+int
+train_page(const char *sid, const char *train, int day, bool local, char *fname, size_t sz)
+{
+	char url[100], path[32], key[16];
+
+	snprintf(fname, sz, "%s/njtransit-train-%s-%d.html", page_dir, train, day);
+
+	if (debug)
+		return 0;
+
+	snprintf(url, sizeof(url), train_url, sid, strlen(train) == 2 ? "00" : "", train);
+	snprintf(path, sizeof(path), "/v1/page/%s/%s", sid, train);
+	snprintf(key, sizeof(key), "train-%s", train);
+
+	return page_fetch(key, path, url, fname, local);
+}
+
+static int
+board_fetch(station_id id, char *fname, size_t sz)
+{
+	return board_page(station_code(id), false, fname, sz);
+}
+
+/* Returns a new board of the station, NULL if its page can't be fetched or read. */
+struct station*
+station_create(station_id id)
+{
+	char fname[PATH_MAX];
+	struct stat page;
+	struct trace_span span;
+
+	trace_begin(&span, "board", "station_create");
+
+	if (board_fetch(id, fname, sizeof(fname)) != 0 || stat(fname, &page) != 0) {
+		log_msg(LEVEL_WARN, "no board page", station_code(id));
+		trace_end(&span, station_code(id), 0);
+		return NULL;
+	}
+
+	struct station* st = calloc(1, sizeof(struct station));
+	if (st == NULL)
+		err(1, "Cannot allocate station");
+
+	st->id = id;
+
+	/* debug runs parse the page to trace it */
+	if (debug || shm_board_get(st, &page) != 0) {
+		if (station_load(st, fname) != 0) {
+			free(st);
+			trace_end(&span, station_code(id), 0);
+			return NULL;
+		}
+		if (!debug)
+			shm_board_put(st, &page);
+	} else {
+		trace_mark("cache", "shm hit", station_code(id));
+	}
+
+	mem_charge(MEM_BOARDS, st->bytes);
+	trace_end(&span, station_code(id), page.st_size);
+
+	return st;
+}
+
+/*
+ * Calls fn for every departure of the station while its page is parsed,
+ * without building the board. Returns -1 if the page can't be fetched.
+ */
+int
+station_stream(station_id id, int (*fn)(void *arg, struct departure *dep), void *arg)
+{
+	char fname[PATH_MAX];
+	const char *text;
+	size_t len;
+	struct trace_span span;
+
+	if (board_fetch(id, fname, sizeof(fname)) != 0 || map_text(fname, &text, &len) != 0)
+		return -1;
+
+	trace_begin(&span, "parse", "station_stream");
+	board_scan(id, text, len, NULL, fn, arg);
+	unmap_text(text, len);
+	trace_end(&span, station_code(id), len);
+
+	return 0;
+}
+
+void
+station_dump(struct station *s)
+{
+	printf("=== %s(%s) === [%zu] =====================\n",
+		station_name(s->id), station_code(s->id), s->deps->size);
+
+	struct departure header = {
+		.time = "DEP",
+		.train = "TRAIN",
+		.dest = STATION_NONE,
+		.destination = "TO",
+		.track = "TRK",
+		.status = "STATUS",
+	};
+
+	departure_dump(&header);
+
+	struct departure* dep;
+
+	SLIST_FOREACH(dep, s->deps->list, entries) {
+		departure_dump(dep);
+	}
+
+	printf("--\n");
+}
+
+void
+station_destroy(struct station *s)
+{
+	if (s == NULL)
+		return;
+
+	struct departure *dep;
+
+	while (!SLIST_EMPTY(s->deps->list)) {
+		dep = SLIST_FIRST(s->deps->list);
+		SLIST_REMOVE_HEAD(s->deps->list, entries);
+		free(dep);
+	}
+
+	mem_uncharge(MEM_BOARDS, s->bytes);
+
+	free(s->deps);
+	if (s->text != NULL)
+		strpool_free(s->text);
+	free(s->text);
+	free(s);
+}
+
+static struct flight_group stops_flights = FLIGHT_GROUP_INITIALIZER;
+
+/* finds the stop name and status spans of a train stops row */
+static void
+parse_par(const char *text, size_t len, const char **name, size_t *name_len,
+	const char **status, size_t *status_len)
+{
+	regex_t p1, p2;
+	regmatch_t m1, m2;
+
+	int rc = regcomp(&p1, "<p[^>]*>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p1);
+
+	rc = regcomp(&p2, "</p>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p2);
+
+	m1.rm_so = 0;
+	m1.rm_eo = len;
+
+	rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
+
+	if (rc == REG_NOMATCH)
+		return;
+
+	if (rc != 0)
+		print_rex_error(rc, &p1);
+
+	m2.rm_so = m1.rm_eo;
+	m2.rm_eo = len;
+
+	rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
+
+	if (rc == REG_NOMATCH)
+		return;
+
+	if (rc != 0)
+		print_rex_error(rc, &p2);
+
+
+	size_t plen = m2.rm_so - m1.rm_eo;
+	const char *ptext = &text[m1.rm_eo];
+	log_text(LEVEL_DEBUG, "p raw", NULL, ptext, plen);
+	const char *p = memmem(ptext, plen, "&nbsp;&nbsp;", 12);
+
+	*name = ptext;
+	*name_len = p != NULL ? (size_t)(p - ptext) : plen;
+	*status = p != NULL ? p + 12 : &text[m2.rm_so];
+	*status_len = &text[m2.rm_so] - *status;
+
+	log_text(LEVEL_DEBUG, "stop name", NULL, *name, *name_len);
+	log_text(LEVEL_DEBUG, "stop status", NULL, *status, *status_len);
+}
+
+/* appends a stop to the route of the train */
+static void
+train_stops_add(struct train_stops *ts, const char *name, size_t name_len,
+	const char *status, size_t status_len)
+{
+	struct stop *stop;
+
+	if (ts->n == ts->cap) {
+		ts->cap = ts->cap == 0 ? 16 : ts->cap * 2;
+		ts->stops = realloc(ts->stops, ts->cap * sizeof(struct stop));
+		if (ts->stops == NULL)
+			err(1, "Cannot allocate train stops");
+	}
+
+	stop = &ts->stops[ts->n];
+	stop->name = strndup(name, name_len);
+	stop->id = station_by_name(stop->name);
+	stop->status = strndup(status, status_len);
+	if (stop->name == NULL || stop->status == NULL)
+		err(1, "Cannot allocate stop");
+
+	/* a route passing a station twice is indexed at its first stop */
+	if (stop->id != STATION_NONE && ts->at[stop->id] == 0 && ts->n < UINT8_MAX)
+		ts->at[stop->id] = ts->n + 1;
+
+	ts->bytes += strlen(stop->name) + strlen(stop->status) + 2;
+	ts->n++;
+}
+
+static int
+parse_train_stops(const char *fname, struct train_stops *ts)
+{
+	int rc;
+	regex_t p1, p2;
+	regmatch_t m1, m2;
+	const char *text;
+	size_t len;
+	struct trace_span span;
+
+	if (map_text(fname, &text, &len) != 0)
+		return -1;
+
+	trace_begin(&span, "parse", "parse_train_stops");
+
+	rc = regcomp(&p1, "<tr[^>]*>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p1);
+
+	rc = regcomp(&p2, "</tr>", REG_EXTENDED);
+	if (rc != 0)
+		print_rex_error(rc, &p2);
+
+	m1.rm_so = 0;
+	m1.rm_eo = len;
+
+	for (;;)
+	{
+		rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
+
+		if (rc == REG_NOMATCH)
+			break;
+
+		if (rc != 0)
+			print_rex_error(rc, &p1);
+
+		m2.rm_so = m1.rm_eo;
+		m2.rm_eo = len;
+
+		rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
+
+		if (rc == REG_NOMATCH)
+			break;
+
+		if (rc != 0)
+			print_rex_error(rc, &p2);
+
+
+		size_t tdlen = m2.rm_so - m1.rm_eo;
+		log_text(LEVEL_DEBUG, "tr", NULL, &text[m1.rm_eo], tdlen);
+
+		const char *name = NULL, *status;
+		size_t name_len, status_len;
+
+		parse_par(&text[m1.rm_eo], tdlen, &name, &name_len, &status, &status_len);
+
+		if (name != NULL)
+			train_stops_add(ts, name, name_len, status, status_len);
+
+		m1.rm_so = m2.rm_eo;
+		m1.rm_eo = len;
+	}
+
+	regfree(&p1);
+	regfree(&p2);
+	unmap_text(text, len);
+	trace_end(&span, fname, len);
+
+	return 0;
+}
+
+/* ===== train stops cache ===================
+ *
+ * A train runs the same route all day whichever station asks about it, so
+ * its stops page is cached and parsed once per train number and service
+ * day. The page is requested with the sid of the first station that asks.
+ * Cached lists are refcounted like boards and evicted by the same CLOCK
+ * sweep when the memory budget is exceeded. When a refresh fails the old
+ * list, or an empty failed entry, is kept and not refreshed for a while.
+ */
+
+#define STOPS_TTL       60
+#define FAILED_TTL      15              /* seconds a failed fetch is not retried */
+
+LIST_HEAD(train_stops_list, train_stops);
+
+static struct train_stops_list trains = LIST_HEAD_INITIALIZER(trains);
+static pthread_mutex_t trains_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct train_stops_req
+{
+	const char      *sid;           /* station to request the page for */
+	const char      *train;         /* train number */
+	int             day;            /* service day */
+};
+
+static void
+train_stops_free(struct train_stops *ts)
+{
+	size_t i;
+
+	mem_uncharge(MEM_STOPS, ts->bytes);
+
+	for (i = 0; i < ts->n; i++) {
+		free(ts->stops[i].name);
+		free(ts->stops[i].status);
+	}
+
+	free(ts->stops);
+	free(ts);
+}
+
+static struct train_stops *
+train_stops_new()
+{
+	struct train_stops *ts = calloc(1, sizeof(struct train_stops));
+	if (ts == NULL)
+		err(1, "Cannot allocate train stops");
+
+	ts->loaded = clock_now();
+	ts->bytes = sizeof(struct train_stops);
+	atomic_init(&ts->refs, 1);
+
+	return ts;
+}
+
+/*
+ * Parses a saved train stops page into an uncached list. Returns NULL if
+ * the page can't be read.
+ */
+struct train_stops *
+train_stops_parse(const char *fname)
+{
+	struct train_stops *ts = train_stops_new();
+
+	if (parse_train_stops(fname, ts) != 0) {
+		free(ts->stops);
+		free(ts);
+		return NULL;
+	}
+
+	ts->bytes += ts->n * sizeof(struct stop);
+	mem_charge(MEM_STOPS, ts->bytes);
+
+	return ts;
+}
+
+/* returns the cached entry of the train, under trains_lock */
+static struct train_stops *
+train_stops_find(const char *train, int day)
+{
+	struct train_stops *ts;
+
+	LIST_FOREACH(ts, &trains, entries) {
+		if (ts->day == day && strcmp(ts->train, train) == 0)
+			return ts;
+	}
+
+	return NULL;
+}
+
+/* publishes ts in the cache, replacing its older list and lists of past days */
+static void
+train_stops_cache(struct train_stops *ts)
+{
+	struct train_stops_list gone = LIST_HEAD_INITIALIZER(gone);
+	struct train_stops *t, *next;
+
+	pthread_mutex_lock(&trains_lock);
+
+	for (t = LIST_FIRST(&trains); t != NULL; t = next) {
+		next = LIST_NEXT(t, entries);
+		if (t->day == ts->day && strcmp(t->train, ts->train) != 0)
+			continue;
+
+		LIST_REMOVE(t, entries);
+		LIST_INSERT_HEAD(&gone, t, entries);
+	}
+
+	atomic_fetch_add(&ts->refs, 1);
+	ts->referenced = true;
+	LIST_INSERT_HEAD(&trains, ts, entries);
+
+	pthread_mutex_unlock(&trains_lock);
+
+	while (!LIST_EMPTY(&gone)) {
+		t = LIST_FIRST(&gone);
+		LIST_REMOVE(t, entries);
+		train_stops_release(t);
+	}
+}
+
+/*
+ * Keeps the cached list of a train whose refresh failed for FAILED_TTL,
+ * or caches a failed entry if there is none. Returns the referenced old
+ * list, NULL if there is none.
+ */
+static struct train_stops *
+train_stops_failed(struct train_stops_req *req)
+{
+	struct train_stops *ts;
+	time_t now = clock_now();
+
+	pthread_mutex_lock(&trains_lock);
+	ts = train_stops_find(req->train, req->day);
+	if (ts != NULL) {
+		ts->retry = now + FAILED_TTL;
+		if (ts->failed)
+			ts = NULL;
+		else
+			atomic_fetch_add(&ts->refs, 1);
+		pthread_mutex_unlock(&trains_lock);
+		return ts;
+	}
+	pthread_mutex_unlock(&trains_lock);
+
+	log_msg(LEVEL_WARN, "no stops page", req->train);
+
+	ts = train_stops_new();
+	strcpy(ts->train, req->train);
+	ts->day = req->day;
+	ts->failed = true;
+	ts->retry = now + FAILED_TTL;
+	mem_charge(MEM_STOPS, ts->bytes);
+
+	train_stops_cache(ts);
+	train_stops_release(ts);
+
+	return NULL;
+}
+
+static void *
+train_stops_load(const char *key, void *arg)
+{
+	struct train_stops_req *req = arg;
+	char fname[PATH_MAX];
+
+	if (train_page(req->sid, req->train, req->day, false, fname, sizeof(fname)) != 0)
+		return train_stops_failed(req);
+
+	struct train_stops *ts = train_stops_parse(fname);
+	if (ts == NULL)
+		return train_stops_failed(req);
+
+	strcpy(ts->train, req->train);
+	ts->day = req->day;
+
+	if (debug) {
+		size_t i;
+		for (i = 0; i < ts->n; i++) {
+			printf("stop: %s(%s), %s\n", ts->stops[i].name, station_code(ts->stops[i].id),
+			       ts->stops[i].status);
+		}
+	}
+
+	train_stops_cache(ts);
+	mem_reclaim();
+
+	return ts;
+}
+
+static void
+train_stops_share(void *p)
+{
+	struct train_stops *ts = p;
+	atomic_fetch_add(&ts->refs, 1);
+}
+
+/*
+ * Returns the stops of the train, requesting the page for the station
+ * if the train is not cached yet. Concurrent requests for one train share
+ * one fetch and one parsed list. Returns NULL if the stops are unknown.
+ */
+struct train_stops *
+get_prev_stations(station_id from, const char *train)
+{
+	struct train_stops_req req = { station_code(from), train, 0 };
+	struct train_stops *ts;
+	struct trace_span span;
+	time_t now = clock_now();
+	char key[32];
+
+	if (req.sid == NULL || strlen(train) >= sizeof(ts->train))
+		return NULL;
+
+	trace_begin(&span, "stops", "get_prev_stations");
+
+	req.day = service_day(now);
+
+	pthread_mutex_lock(&trains_lock);
+	ts = train_stops_find(train, req.day);
+	if (ts != NULL && ((!ts->failed && ts->loaded + STOPS_TTL >= now) || ts->retry > now)) {
+		ts->referenced = true;
+		if (ts->failed)
+			ts = NULL;
+		else
+			atomic_fetch_add(&ts->refs, 1);
+		pthread_mutex_unlock(&trains_lock);
+		trace_mark("cache", ts != NULL ? "stops hit" : "stops failed", train);
+		trace_end(&span, train, 0);
+		return ts;
+	}
+	pthread_mutex_unlock(&trains_lock);
+
+	trace_mark("cache", "stops miss", train);
+	snprintf(key, sizeof(key), "%s-%d", train, req.day);
+
+	ts = flight_do(&stops_flights, key, train_stops_load, &req, train_stops_share);
+	trace_end(&span, train, 0);
+
+	return ts;
+}
+
+void
+train_stops_release(struct train_stops *ts)
+{
+	if (ts != NULL && atomic_fetch_sub(&ts->refs, 1) == 1)
+		train_stops_free(ts);
+}
+
+/* Returns the stop of the train at the station, NULL if it doesn't stop there. */
+const struct stop *
+train_stop(const struct train_stops *ts, station_id id)
+{
+	if (id >= STATION_NONE || ts->at[id] == 0)
+		return NULL;
+
+	return &ts->stops[ts->at[id] - 1];
+}
+
+/*
+ * Drops the cache's reference to one train that was not used since the
+ * last sweep. Returns the bytes of the evicted list, 0 if none is cached.
+ */
+size_t
+train_stops_evict()
+{
+	struct train_stops *ts = NULL;
+	int pass;
+
+	pthread_mutex_lock(&trains_lock);
+	for (pass = 0; pass < 2 && ts == NULL; pass++) {
+		LIST_FOREACH(ts, &trains, entries) {
+			if (!ts->referenced)
+				break;
+			ts->referenced = false;
+		}
+	}
+	if (ts != NULL)
+		LIST_REMOVE(ts, entries);
+	pthread_mutex_unlock(&trains_lock);
+
+	if (ts == NULL)
+		return 0;
+
+	log_num(LEVEL_INFO, "evict train bytes", ts->train, ts->bytes);
+
+	size_t bytes = ts->bytes;
+	train_stops_release(ts);
+
+	return bytes;
+}
+
+/* ===== board snapshots =====================
+ *
+ * Every station has one published board. Readers load it inside an rcu
+ * read section and take a reference before leaving it, so they never
+ * lock and may keep the board for as long as they need. A refresh parses
+ * a new board and swaps it in; the store's reference to the old one is
+ * dropped after the rcu grace period. A failed refresh keeps the old board
+ * and is not retried for FAILED_TTL, so a station that is down costs one
+ * failed fetch per interval instead of one per query.
+ */
+
+#define MAX_STATIONS   STATION_NONE
+#define BOARD_TTL      60
+
+static struct station *_Atomic boards[MAX_STATIONS];
+static atomic_uint_fast64_t versions[MAX_STATIONS];
+static _Atomic time_t retry[MAX_STATIONS];      /* no refresh before, after a failed one */
+static atomic_bool referenced[MAX_STATIONS];   /* used since the last eviction sweep */
+static size_t clock_hand = 0;                   /* next slot to sweep, under mem_reclaim */
+static struct flight_group board_flights = FLIGHT_GROUP_INITIALIZER;
+
+static void
+board_unref(void *p)
+{
+	board_release(p);
+}
+
+/* returns a reference to the published board, however old */
+static struct station *
+board_stale(station_id idx)
+{
+	struct station *st;
+
+	rcu_read_lock();
+	st = atomic_load(&boards[idx]);
+	if (st != NULL)
+		atomic_fetch_add(&st->refs, 1);
+	rcu_read_unlock();
+
+	return st;
+}
+
+static void *
+board_refresh(const char *code, void *arg)
+{
+	station_id idx = *(station_id *)arg;
+	struct station *st, *old;
+
+	st = station_create(idx);
+	if (st == NULL) {
+		atomic_store(&retry[idx], clock_now() + FAILED_TTL);
+		return board_stale(idx);
+	}
+
+	atomic_init(&st->refs, 2); /* store and caller */
+	st->version = atomic_fetch_add(&versions[idx], 1) + 1;
+
+	old = atomic_exchange(&boards[idx], st);
+	if (old != NULL)
+		rcu_retire(old, board_unref);
+
+	atomic_store(&referenced[idx], true);
+	mem_reclaim();
+	rcu_reclaim();
+	arrivals_board_loaded(idx);
+
+	return st;
+}
+
+static void
+board_share(void *p)
+{
+	struct station *st = p;
+	atomic_fetch_add(&st->refs, 1);
+}
+
+/*
+ * Returns a referenced board for the station, refreshing it when it is
+ * missing or too old. Concurrent refreshes of one station are coalesced.
+ * Returns an old board if the refresh fails, NULL if there is none.
+ */
+struct station *
+board_get(station_id idx)
+{
+	struct station *st;
+
+	if (idx >= n_stations)
+		return NULL;
+
+	rcu_read_lock();
+	st = atomic_load(&boards[idx]);
+	if (st != NULL && st->loaded + BOARD_TTL >= clock_now()) {
+		atomic_fetch_add(&st->refs, 1);
+		rcu_read_unlock();
+		if (!atomic_load_explicit(&referenced[idx], memory_order_relaxed))
+			atomic_store(&referenced[idx], true);
+		trace_mark("cache", "board hit", station_code(idx));
+		return st;
+	}
+	rcu_read_unlock();
+
+	if (atomic_load(&retry[idx]) > clock_now()) {
+		trace_mark("cache", "board failed", station_code(idx));
+		return board_stale(idx);
+	}
+
+	trace_mark("cache", "board miss", station_code(idx));
+	return flight_do(&board_flights, station_code(idx), board_refresh, &idx, board_share);
+}
+
+void
+board_release(struct station *st)
+{
+	if (st != NULL && atomic_fetch_sub(&st->refs, 1) == 1)
+		station_destroy(st);
+}
+
+/*
+ * Drops the store's reference to one board that was not used since the
+ * clock hand last passed it. Returns the bytes of the evicted board, 0 if
+ * no board is published.
+ */
+size_t
+board_evict()
+{
+	struct station *st;
+	size_t i, idx, bytes;
+
+	for (i = 0; i < 2 * n_stations; i++) {
+		idx = clock_hand;
+		clock_hand = (clock_hand + 1) % n_stations;
+
+		if (atomic_load(&boards[idx]) == NULL || atomic_exchange(&referenced[idx], false))
+			continue;
+
+		st = atomic_exchange(&boards[idx], NULL);
+		if (st == NULL)
+			continue;
+
+		bytes = st->bytes;
+		log_num(LEVEL_INFO, "evict board bytes", station_code(idx), bytes);
+
+		rcu_retire(st, board_unref);
+		return bytes;
+	}
+
+	return 0;
+}
+
+static const struct departure *
+departure_find(const struct station *st, const char *train)
+{
+	const struct departure *dep;
+
+	if (st == NULL)
+		return NULL;
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		if (strcmp(dep->train, train) == 0)
+			return dep;
+	}
+
+	return NULL;
+}
+
+static int
+field_changed(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a != b;
+
+	return strcmp(a, b) != 0;
+}
+
+/*
+ * Compares two boards of one station row by row, keyed by train number,
+ * and calls cb for every added, changed or removed row. Removed rows are
+ * reported with the old departure. Returns the number of changes.
+ */
+size_t
+board_diff(const struct station *old, const struct station *st,
+	   void (*cb)(void *arg, enum row_change change, const struct departure *dep), void *arg)
+{
+	const struct departure *dep, *prev;
+	size_t n = 0;
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		prev = departure_find(old, dep->train);
+
+		if (prev == NULL) {
+			cb(arg, ROW_ADDED, dep);
+			n++;
+		} else if (field_changed(prev->time, dep->time) ||
+			   field_changed(prev->track, dep->track) ||
+			   prev->dest != dep->dest ||
+			   field_changed(prev->status, dep->status)) {
+			cb(arg, ROW_CHANGED, dep);
+			n++;
+		}
+	}
+
+	if (old == NULL)
+		return n;
+
+	SLIST_FOREACH(prev, old->deps->list, entries) {
+		if (departure_find(st, prev->train) == NULL) {
+			cb(arg, ROW_REMOVED, prev);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void
+board_deps_add(struct board_deps *d, const struct station *st)
+{
+	size_t i;
+
+	if (d == NULL || d->n > MAX_BOARD_DEPS)
+		return;
+
+	for (i = 0; i < d->n; i++) {
+		if (d->idx[i] == st->id && d->version[i] == st->version)
+			return;
+	}
+
+	if (d->n == MAX_BOARD_DEPS) {
+		d->n++;
+		return;
+	}
+
+	d->idx[d->n] = st->id;
+	d->version[d->n] = st->version;
+	d->n++;
+}
+
+/* Marks output built without some board as never current, so it is not cached. */
+void
+board_deps_missing(struct board_deps *d)
+{
+	if (d != NULL)
+		d->n = MAX_BOARD_DEPS + 1;
+}
+
+/*
+ * Returns 1 if every board is still published with the same version and
+ * not expired, so output built from them is still valid.
+ */
+int
+board_deps_current(const struct board_deps *d)
+{
+	size_t i;
+	struct station *st;
+	int current = d->n <= MAX_BOARD_DEPS;
+	time_t now = clock_now();
+
+	rcu_read_lock();
+	for (i = 0; current && i < d->n; i++) {
+		st = atomic_load(&boards[d->idx[i]]);
+		current = st != NULL && st->version == d->version[i] && st->loaded + BOARD_TTL >= now;
+	}
+	rcu_read_unlock();
+
+	return current;
+}
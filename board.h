@@ -0,0 +1,127 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/queue.h>
+#include <time.h>
+
+extern int debug;                       /* debug parameter */
+extern const char *page_dir;            /* directory of the saved pages */
+
+/* ===== data structures ===================== */
+
+struct departure
+{
+	char            *time;          /* departure time */
+	char            *destination;   /* destination station name */
+	char            *line;          /* rail route name */
+	char            *train;         /* train label or number */
+	char            *track;         /* departure track label or number */
+	char            *status;        /* train status */
+	station_id      dest;           /* destination station */
+	time_t          scheduled;      /* timetable departure, 0 if unknown */
+	SLIST_ENTRY(departure) entries; /* handler for slist */
+};
+
+SLIST_HEAD(departure_list, departure);
+
+struct departures
+{
+	struct departure_list *list;   /* departures list */
+	size_t size;                   /* departures list size */
+};
+
+/*
+ * Station board. Once published by board_get() it is an immutable snapshot
+ * shared between threads and freed when the last reference is released.
+ */
+struct station
+{
+	station_id id;                  /* station */
+	struct departures* deps;        /* list of departures for this station */
+	struct strpool *text;           /* parsed text the departures point into */
+	size_t bytes;                   /* bytes allocated for the board */
+	time_t loaded;                  /* time when the page was parsed */
+	uint64_t version;               /* board version, bumped on every publish */
+	atomic_int refs;                /* snapshot references */
+	SLIST_ENTRY(station) entries;   /* handler for slist */
+};
+
+SLIST_HEAD(station_list, station);
+
+struct route
+{
+	const char *name;                  /* route name */
+	struct station_list *stations;     /* station list for this route */
+};
+
+struct stop
+{
+	char *name;
+	station_id id;
+	char *status;
+};
+
+/*
+ * Parsed stops of a train for one service day, shared between requests
+ * from every station on its route.
+ */
+struct train_stops
+{
+	char train[8];                  /* train number */
+	int day;                        /* service day, yyyymmdd */
+	struct stop *stops;             /* stops in route order */
+	size_t n;                       /* number of stops */
+	size_t cap;                     /* allocated stops */
+	uint8_t at[STATION_NONE];       /* 1 + index of the stop at a station, 0 if none */
+	size_t bytes;                   /* bytes allocated for the list */
+	time_t loaded;                  /* time when the page was parsed */
+	time_t retry;                   /* no refresh before, after a failed one */
+	bool failed;                    /* no page, the train stops are unknown */
+	bool referenced;                /* used since the last eviction sweep */
+	atomic_int refs;                /* references */
+	LIST_ENTRY(train_stops) entries;/* handler for the cache list */
+};
+
+enum row_change
+{
+	ROW_ADDED,                      /* train appeared on the board */
+	ROW_CHANGED,                    /* time, track, destination or status changed */
+	ROW_REMOVED,                    /* train left the board */
+};
+
+#define MAX_BOARD_DEPS  32
+
+/* Board versions some output was built from. */
+struct board_deps
+{
+	size_t          n;                      /* number of boards, > MAX_BOARD_DEPS on overflow or a missing board */
+	station_id      idx[MAX_BOARD_DEPS];    /* station */
+	uint64_t        version[MAX_BOARD_DEPS];/* board version */
+};
+
+/* =========================================== */
+
+void use_debug_server(void);
+int board_page(const char *sid, bool local, char *fname, size_t sz);
+int train_page(const char *sid, const char *train, int day, bool local, char *fname, size_t sz);
+struct station *station_create(station_id id);
+struct station *station_parse(station_id id, const char *fname);
+int station_stream(station_id id, int (*fn)(void *arg, struct departure *dep), void *arg);
+void station_dump(struct station *s);
+void station_destroy(struct station *s);
+
+struct train_stops *get_prev_stations(station_id from, const char *train);
+struct train_stops *train_stops_parse(const char *fname);
+void train_stops_release(struct train_stops *ts);
+const struct stop *train_stop(const struct train_stops *ts, station_id id);
+size_t train_stops_evict(void);
+
+struct station *board_get(station_id id);
+void board_release(struct station *st);
+size_t board_evict(void);
+size_t board_diff(const struct station *old, const struct station *st,
+		  void (*cb)(void *arg, enum row_change change, const struct departure *dep), void *arg);
+void board_deps_add(struct board_deps *d, const struct station *st);
+void board_deps_missing(struct board_deps *d);
+int board_deps_current(const struct board_deps *d);
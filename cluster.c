@@ -0,0 +1,175 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "cluster.h"
+
+#define CLUSTER_VNODES          64      /* ring points per node */
+#define CLUSTER_POLL            60      /* seconds between polls of a board */
+
+struct point
+{
+	uint32_t        hash;           /* position on the ring */
+	uint8_t         node;           /* node owning the keys up to it */
+};
+
+static char nodes[CLUSTER_MAX_NODES][64];      /* host:port */
+static size_t n_nodes = 0;
+static size_t self_node;
+static struct point ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static size_t n_points = 0;
+
+/* FNV-1a */
+static uint32_t
+hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+
+	/* spread nearby keys like "XG" and "XH" over the ring */
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+
+	return h;
+}
+
+static int
+compare_points(const void *v1, const void *v2)
+{
+	const struct point *p1 = v1;
+	const struct point *p2 = v2;
+
+	if (p1->hash != p2->hash)
+		return p1->hash < p2->hash ? -1 : 1;
+
+	return (int)p1->node - (int)p2->node;
+}
+
+/*
+ * Builds the ring from the comma separated host:port list of peers, which
+ * must include self. Returns -1 if the list is invalid.
+ */
+int
+cluster_init(const char *peers, const char *self)
+{
+	char *list, *s, *node, key[sizeof(nodes[0]) + 21];
+	size_t i, v;
+	int found = 0;
+
+	list = strdup(peers);
+	if (list == NULL)
+		err(1, "Cannot allocate peers");
+
+	for (s = list; (node = strsep(&s, ",")) != NULL; ) {
+		if (*node == 0)
+			continue;
+		if (n_nodes == CLUSTER_MAX_NODES || strlen(node) >= sizeof(nodes[0])) {
+			free(list);
+			return -1;
+		}
+		if (strcmp(node, self) == 0) {
+			self_node = n_nodes;
+			found = 1;
+		}
+		strcpy(nodes[n_nodes++], node);
+	}
+
+	free(list);
+
+	if (!found) {
+		n_nodes = 0;
+		return -1;
+	}
+
+	for (i = 0; i < n_nodes; i++) {
+		for (v = 0; v < CLUSTER_VNODES; v++) {
+			snprintf(key, sizeof(key), "%.*s#%zu", (int)sizeof(nodes[0]) - 1, nodes[i], v);
+			ring[n_points].hash = hash(key);
+			ring[n_points].node = i;
+			n_points++;
+		}
+	}
+
+	qsort(ring, n_points, sizeof(struct point), compare_points);
+
+	return 0;
+}
+
+/* Returns the host:port of the peer owning key, NULL if it is this node. */
+const char *
+cluster_owner(const char *key)
+{
+	uint32_t h;
+	size_t lo = 0, hi = n_points, mid;
+
+	if (n_nodes < 2)
+		return NULL;
+
+	/* first point at or after the key, wrapping around */
+	h = hash(key);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ring[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == n_points)
+		lo = 0;
+
+	return ring[lo].node != self_node ? nodes[ring[lo].node] : NULL;
+}
+
+/* refreshes the boards of the stations this node owns, spread over the interval */
+static void *
+cluster_poll(void *arg)
+{
+	station_id owned[STATION_NONE];
+	struct station *st;
+	size_t i, n = 0;
+	station_id id;
+
+	for (id = 0; id < n_stations; id++)
+		if (cluster_owner(station_code(id)) == NULL)
+			owned[n++] = id;
+
+	if (n == 0)
+		return NULL;
+
+	for (i = 0; ; i = (i + 1) % n) {
+		st = board_get(owned[i]);
+		if (st != NULL)
+			board_release(st);
+		usleep(CLUSTER_POLL * 1000000 / n);
+	}
+
+	return NULL;
+}
+
+/* polls the shard of this node on a thread next to the API server */
+void
+cluster_poll_start()
+{
+	pthread_t thread;
+
+	if (n_nodes < 2)
+		return;
+
+	if (pthread_create(&thread, NULL, cluster_poll, NULL) != 0)
+		errx(1, "Cannot create cluster poll thread");
+
+	pthread_detach(thread);
+}
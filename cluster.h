@@ -0,0 +1,18 @@
+/*
+ * Cluster of API servers sharing the upstream load.
+ *
+ * Every node is started with the same list of peers, itself included.
+ * Station codes and train numbers are mapped to nodes by consistent
+ * hashing, so adding a node moves only its share of the keys. A node
+ * fetches the pages it owns from upstream and asks the owner for the
+ * others through /v1/page, going upstream itself only if the owner can't
+ * be reached. Each page is then fetched upstream by one node, however
+ * many nodes there are. A serving node polls the boards of the stations
+ * it owns, so its peers find them fresh.
+ */
+
+#define CLUSTER_MAX_NODES       16
+
+int cluster_init(const char *peers, const char *self);
+const char *cluster_owner(const char *key);
+void cluster_poll_start();
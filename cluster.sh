@@ -0,0 +1,48 @@
+#!/bin/bash
+# usage: cluster.sh start n [base_port] [departures options]
+#        cluster.sh stop
+#
+# Runs a cluster of n API servers on loopback ports from base_port (8100),
+# each with its own page directory under /tmp/departures-node-PORT, to try
+# the peer page fill on one box. DEPARTURES overrides the binary.
+
+DEPARTURES=${DEPARTURES:-$HOME/b/departuresb/bin/departures}
+RUNDIR=/tmp/departures-cluster
+
+if [[ $1 == stop ]] ; then
+	for pid in $RUNDIR/*.pid ; do
+		[[ -f $pid ]] && kill $(cat $pid) 2> /dev/null
+		rm -f $pid
+	done
+	exit 0
+fi
+
+if [[ $1 != start || -z $2 ]] ; then
+	echo usage: cluster.sh start n [base_port] [departures options]
+	echo '      ' cluster.sh stop
+	exit 1
+fi
+
+n=$2
+shift 2
+base=8100
+if [[ $1 =~ ^[0-9]+$ ]] ; then
+	base=$1
+	shift
+fi
+
+peers=
+for i in $(seq 0 $((n - 1))) ; do
+	peers=$peers${peers:+,}127.0.0.1:$((base + i))
+done
+
+mkdir -p $RUNDIR
+
+for i in $(seq 0 $((n - 1))) ; do
+	port=$((base + i))
+	mkdir -p /tmp/departures-node-$port
+	$DEPARTURES -S $port -N $peers -I 127.0.0.1:$port -C /tmp/departures-node-$port "$@" \
+		> $RUNDIR/$port.log 2>&1 &
+	echo $! > $RUNDIR/$port.pid
+	echo node 127.0.0.1:$port, pid $!
+done
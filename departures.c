@@ -21,19 +21,48 @@
 
 #include "common/net.h"
 #include "stations.h"
-#include "parser.h"
+#include "api.h"
+#include "bench.h"
+#include "cluster.h"
+#include "board.h"
+#include "report.h"
+#include "arrivals.h"
+#include "render.h"
+#include "schedule.h"
+#include "mem.h"
+#include "prefetch.h"
+#include "server.h"
+#include "trace.h"
+#include "log.h"
+#include "archive.h"
 #include "util.h"
-#include "color.h"
 #include "version.h"
 #include "api_help.txt.h"
 
-static int debug = 0;                 /* debug parameter */
-static char *station_from = NULL;     /* departure station */
-static char *station_to = NULL;       /* destination station */
-static FILE *log = NULL;              /* verbose debug log */
+int debug = 0;                        /* debug parameter */
+static station_id station_from[MAX_ORIGINS]; /* departure stations */
+static size_t n_from = 0;             /* number of departure stations */
+static station_id station_to = STATION_NONE;   /* destination station */
 static int email = 0;                 /* send email */
 static int all = 0;                   /* show all trains for station */
+static int debug_server = 0;          /* pages from the debug server */
 static char *train = NULL;            /* train code */
+static const char *serve_port = NULL; /* run API server on this port */
+static int workers = 4;               /* number of server worker threads */
+static const char *prefetch_file = NULL; /* subscription schedule to prefetch for */
+static station_id arrivals_at = STATION_NONE; /* show arrivals at this station */
+static const char *gtfs_zip = NULL;    /* GTFS timetable to import */
+static const char *schedule_file = SCHEDULE_FILE; /* timetable index */
+static const char *peers = NULL;       /* cluster nodes, host:port list */
+static const char *self = NULL;        /* this node in the list */
+static const char *log_fname = NULL;   /* log decisions to this file */
+static const char *archive_dir = NULL; /* archive fetched pages here */
+static const char *dict_dir = NULL;    /* train the dictionary of this archive */
+static const char *replay_dir = NULL;  /* replay this archive */
+static double replay_speed = 0;        /* times faster than recorded, 0 for no waits */
+static int bench_rounds = 0;           /* benchmark the parser this many rounds */
+static struct board_filter filter;      /* rows shown by --all */
+static enum report_format format = FORMAT_TEXT; /* output format */
 
 static struct option longopts[] = {
 	{ "list",         no_argument,       NULL, 'l' },
@@ -41,8 +70,32 @@ static struct option longopts[] = {
 	{ "to",           required_argument, NULL, 't' },
 	{ "mail",         no_argument,       NULL, 'm' },
 	{ "all",          no_argument,       NULL, 'a' },
+	{ "arrivals",     required_argument, NULL, 'A' },
 	{ "stops",        no_argument,       NULL, 'p' },
 	{ "debug",        no_argument,       NULL, 'd' },
+	{ "debug-server", no_argument,       NULL, 's' },
+	{ "clock",        required_argument, NULL, 'c' },
+	{ "format",       required_argument, NULL, 'F' },
+	{ "serve",        required_argument, NULL, 'S' },
+	{ "workers",      required_argument, NULL, 'w' },
+	{ "memory",       required_argument, NULL, 'M' },
+	{ "prefetch",     required_argument, NULL, 'P' },
+	{ "offset",       required_argument, NULL, 'o' },
+	{ "limit",        required_argument, NULL, 'n' },
+	{ "window",       required_argument, NULL, 'W' },
+	{ "bench",        required_argument, NULL, 'B' },
+	{ "gtfs",         required_argument, NULL, 'G' },
+	{ "schedule",     required_argument, NULL, 'T' },
+	{ "deadline",     required_argument, NULL, 'D' },
+	{ "peers",        required_argument, NULL, 'N' },
+	{ "self",         required_argument, NULL, 'I' },
+	{ "cache",        required_argument, NULL, 'C' },
+	{ "trace",        required_argument, NULL, 'R' },
+	{ "log",          required_argument, NULL, 'L' },
+	{ "archive",      required_argument, NULL, 'Z' },
+	{ "dict",         required_argument, NULL, 'K' },
+	{ "replay",       required_argument, NULL, 'Y' },
+	{ "speed",        required_argument, NULL, 'X' },
 	{ "help",         no_argument,       NULL, 'h' },
 	{ "version",      no_argument,       NULL, 'v' },
 	{ NULL,           0,                 NULL,  0  }
@@ -51,7 +104,14 @@ static struct option longopts[] = {
 static void
 synopsis()
 {
-	printf("usage: departures [-ldmhvap] [-f station] [-t station] [-p train]\n");
+	printf("usage: departures [-ldmhvap] [-f station] [-t station] [-p train] [-F format] [-D ms] [-S port [-w workers] [-M mb]] [-P schedule]\n"
+	       "                  [-N host:port,... -I host:port] [-C dir] [-R file] [-L file] [-Z dir] [-s [-c H:MM]]\n"
+	       "       departures -a [-W min] [-o n] [-n n] [-F format] [-f station] [station ...]\n"
+	       "       departures -A station [-W min] [-o n] [-n n] [-F format] [station ...]\n"
+	       "       departures -B rounds dir ...\n"
+	       "       departures -G gtfs.zip [-T schedule]\n"
+	       "       departures -K dir [page_dir ...]\n"
+	       "       departures -Y dir [-X speed] [-F format] [-f station [-t station] | -W min -o n -n n]\n");
 }
 
 static void
@@ -62,695 +122,64 @@ usage()
 	printf(
 		"options:\n"
 		"    -l, --list            list stations\n"
-		"    -f, --from=station    get next departure and train status\n"
+		"    -f, --from=station    get next departure and train status (code or name),\n"
+		"                          repeat to merge the trains of nearby stations\n"
 		"    -t, --to=station      set destination station\n"
-		"    -a, --all             get all departures for station\n"
+		"    -a, --all             get all departures for station and stations after options\n"
+		"    -A, --arrivals=station  get trains arriving at station from its board and\n"
+		"                          the boards of stations after options\n"
+		"    -W, --window=min      with -a or -A, only trains leaving in the next min minutes\n"
+		"    -o, --offset=n        with -a or -A, skip the first n trains of a board\n"
+		"    -n, --limit=n         with -a or -A, show at most n trains of a board\n"
 		"    -p, --stops=train     get stops for train\n"
 		"    -m, --mail            send email with nearest departure\n"
-		"    -d, --debug           output debug information\n"
+		"    -F, --format=fmt      output format: text or json\n"
+		"    -d, --debug           output debug information, log every parsed row to\n"
+		"                          " DEBUG_LOG "\n"
+		"    -L, --log=file        log fetch and cache decisions to file\n"
+		"    -R, --trace=file      write a Chrome trace of every fetch, cache lookup,\n"
+		"                          parse and render step to file\n"
+		"    -D, --deadline=ms     give up waiting for upstream pages after ms per query\n"
 		"    -s, --debug-server    use debug server\n"
+		"    -c, --clock=H:MM      run as if it were H:MM today, for the saved pages of the\n"
+		"                          debug server\n"
+		"    -S, --serve=port      run API server on port\n"
+		"    -w, --workers=n       number of API server threads (default 4)\n"
+		"    -M, --memory=mb       memory budget for cached boards and reports\n"
+		"    -P, --prefetch=file   warm the cache ahead of the reports scheduled in file\n"
+		"    -N, --peers=list      cluster nodes as host:port,... sharing the upstream pages\n"
+		"    -I, --self=host:port  this node in the cluster list\n"
+		"    -C, --cache=dir       directory of the saved pages (default /tmp)\n"
+		"    -Z, --archive=dir     archive every page fetched from upstream into dir\n"
+		"    -K, --dict=dir        train the compression dictionary of the archive in dir\n"
+		"                          on its pages and the pages in the dirs after options\n"
+		"    -Y, --replay=dir      replay the archive in dir through the reports from -f\n"
+		"                          to -t, or through every board without -f\n"
+		"    -X, --speed=n         replay n times faster than recorded (default 0, no waits)\n"
+		"    -B, --bench=rounds    parse the saved pages in dirs after options rounds times\n"
+		"    -G, --gtfs=zip        import the GTFS timetable into the schedule index\n"
+		"    -T, --schedule=file   schedule index (default " SCHEDULE_FILE ")\n"
 		"    -v, --version         print version\n"
 		);
 }
 
-/* ===== data structures ===================== */
-
-struct departure
-{
-	char            *time;          /* departure time */
-	char            *destination;   /* destination station name */
-	char            *line;          /* rail route name */
-	char            *train;         /* train label or number */
-	char            *track;         /* departure track label or number */
-	char            *status;        /* train status */
-	const char      *code;          /* station code */
-	size_t          next;           /* next train order starting from 1 */
-	SLIST_ENTRY(departure) entries; /* handler for slist */
-};
-
-SLIST_HEAD(departure_list, departure);
-
-struct departures
-{
-	struct departure_list *list;   /* departures list */
-	size_t size;                   /* departures list size */
-};
-
-struct station
-{
-	char *code;                     /* station code */
-	char *name;                     /* station name */
-	struct departures* deps;        /* list of departures for this station */
-	SLIST_ENTRY(station) entries;   /* handler for slist */
-};
-
-SLIST_HEAD(station_list, station);
-
-struct route
-{
-	const char *name;                  /* route name */
-	struct station_list *stations;     /* station list for this route */
-};
-
-struct stop
-{
-	char *name;
-	const char *code;
-	char *status;
-	SLIST_ENTRY(stop) entries;
-};
-
-SLIST_HEAD(stop_list, stop);
-
-/* =========================================== */
-
-static void
-departure_dump(struct departure *d)
-{
-	printf(COL_TIME COL_TRAIN "%s " COL_DEST COL_TRACK "%s\n",
-		d->time, d->train, d->code, d->destination,
-		d->track, d->status);
-}
-
-static void
-parse_tr(char *text, int len, struct departures *deps, struct departure **last_added)
-{
-	if (strnstr(text, " Departures", len) != NULL)
-		return;
-
-	struct trscanner scan;
-	struct departure *dep;
-
-	trscanner_create(&scan, text, len);
-	dep = calloc(1, sizeof(struct departure));
-
-	if (!trscanner_next(&scan))
-		err(1, "first table cell doesn't contain a time");
-
-	dep->time = scan.sbeg; // 1
-
-	if (strncmp("DEP", dep->time, 3) == 0)
-		return;
-
-	if (!trscanner_next(&scan))
-		errx(1, "second table cell doesn't contain a destination station");
-
-	dep->destination = scan.sbeg; // 2
-	if (strstr(dep->destination, "&nbsp;-") != NULL) {
-		strcpy(&dep->destination[strlen(dep->destination)-7], " (SEC)");
-	}
-
-	if (!trscanner_next(&scan))
-		errx(1, "Cannot parse track");
-
-	dep->track = scan.sbeg; // 3
-	if (strcmp("Single", dep->track) == 0)
-		strcpy(dep->track, "1");
-
-	if (!trscanner_next(&scan))
-		errx(1, "Cannot parse line");
-
-	dep->line = scan.sbeg; // 4
-
-	if (!trscanner_next(&scan))
-		errx(1, "Cannot parse train");
-
-	dep->train = scan.sbeg; // 5
-
-	if (trscanner_next(&scan))
-		dep->status = scan.sbeg; // 6
-
-	trscanner_destroy(&scan);
-
-	dep->code = station_code(dep->destination);
-
-	if (*last_added == NULL)
-		SLIST_INSERT_HEAD(deps->list, dep, entries);
-	else
-		SLIST_INSERT_AFTER(*last_added, dep, entries);
-
-	deps->size++;
-	*last_added = dep;
-}
-
-static void
-station_load(struct station* st, const char *fname)
-{
-	int rc;
-	regex_t p1, p2;
-	regmatch_t m1, m2;
-	char *text;
-	size_t len;
-	struct departure *last_added = NULL;
-
-	st->deps = calloc(1, sizeof(struct departures));
-	if (st->deps == NULL)
-		err(1, "Cannot allocate deps");
-
-	st->deps->list = calloc(1, sizeof(struct departure_list));
-	SLIST_INIT(st->deps->list);
-
-	rc = read_text(fname, &text, &len);
-	if (rc != 0)
-		err(rc, "cannot read file");
-
-	if (debug)
-		fprintf(log, "read %zu bytes from %s\n", len, fname);
-
-	rc = regcomp(&p1, "<tr[^>]*>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p1);
-
-	rc = regcomp(&p2, "</tr>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p2);
-
-	m1.rm_so = 0;
-	m1.rm_eo = len;
-
-	for (;;)
-	{
-		rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
-
-		if (rc == REG_NOMATCH)
-			break;
-
-		if (rc != 0)
-			print_rex_error(rc, &p1);
-
-		m2.rm_so = m1.rm_eo;
-		m2.rm_eo = len;
-
-		rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
-
-		if (rc == REG_NOMATCH)
-			break;
-
-		if (rc != 0)
-			print_rex_error(rc, &p2);
-
-		if (debug)
-			fprintf(log, "tr: %.*s\n", (int)(m2.rm_so - m1.rm_so), &text[m1.rm_eo]);
-
-		parse_tr(&text[m1.rm_eo], m2.rm_so - m1.rm_eo, st->deps, &last_added);
-
-		m1.rm_so = m2.rm_eo;
-		m1.rm_eo = len;
-	}
-
-	regfree(&p1);
-	regfree(&p2);
-}
-
-static struct station*
-station_create(const char *station_code)
-{
-	char fname[PATH_MAX];
-	char url[100];
-	const char *api_url = "http://dv.njtransit.com/mobile/tid-mobile.aspx?SID=%s&SORT=A";
-
-	snprintf(fname, PATH_MAX, "/tmp/njtransit-%s.html", station_code);
-
-	struct station* st = calloc(1, sizeof(struct station));
-	if (st == NULL)
-		err(1, "Cannot allocate station");
-
-	st->code = strdup(station_code);
-	st->name = strdup(station_name(station_code));
-
-	snprintf(url, 100, api_url, st->code);
-	if (expired(fname)) {
-
-		struct httpreq_opts opts = {
-			.resp_fname = fname
-		};
-
-		if (debug)
-			fprintf(stderr, "httpreq: %s, dest: %s\n", url, fname);
-
-		if (!debug) {
-			if (httpreq(url, NULL, &opts) != 0)
-				err(1, "Cannot fetch departures for station");
-		}
-	}
-
-	station_load(st, fname);
-
-	return st;
-}
-
-static void
-station_dump(struct station *s)
-{
-	printf("=== %s(%s) === [%zu] =====================\n",
-		s->name, s->code, s->deps->size);
-
-	struct departure header = {
-		.time = "DEP",
-		.train = "TRAIN",
-		.code = "SC",
-		.destination = "TO",
-		.track = "TRK",
-		.status = "STATUS",
-	};
-
-	departure_dump(&header);
-
-	struct departure* dep;
-
-	SLIST_FOREACH(dep, s->deps->list, entries) {
-		departure_dump(dep);
-	}
-
-	printf("--\n");
-}
-
-static void
-station_destroy(struct station *s)
-{
-	if (s == NULL)
-		return;
-
-	struct departure *dep;
-
-	while (!SLIST_EMPTY(s->deps->list)) {
-		dep = SLIST_FIRST(s->deps->list);
-		SLIST_REMOVE_HEAD(s->deps->list, entries);
-		free(dep);
-	}
-
-	free(s->deps);
-	free(s);
-}
-
-/*
- * Sets "next" member to the "1" for the next train, "2" for the train after the next and so on.
- * Returns the number of next trains to  the destination.
- */
-static size_t
-departures_calculate_next(struct departures *deps, const char *dest_code)
-{
-	struct departure *dep;
-	size_t num = 0;
-
-	SLIST_FOREACH(dep, deps->list, entries) {
-		if (dep->code == NULL) {
-			err(1, "No code for station %s", dep->destination);
-		}
-		if (strcmp(dep->code, dest_code) == 0)
-			dep->next = ++num;
-	}
-
-	return num;
-}
-
-static bool
-train_append_status(struct buf *b, struct station *st, const char *train, bool appended)
-{
-	struct departure *dep;
-	int rc;
-	char s[1024];
-	size_t sz = sizeof(s);
-	const char *status = NULL;
-	const char *positive = " Previous stops status:\n\n";
-
-	SLIST_FOREACH(dep, st->deps->list, entries) {
-
-		if (strcmp(train, dep->train) != 0)
-			continue;
-
-		status = dep->status;
-		if (status != NULL && *status != 0) {
-			rc = snprintf(s, sz, "    %s(%s): %s\n", station_name(st->code), st->code, status);
-
-			if (!appended) {
-				buf_append(b, positive, strlen(positive));
-				appended = true;
-			}
-
-			buf_append(b, s, rc);
-		}
-	}
-
-	return appended;
-}
-
-static int
-compare(const void *v1, const void *v2)
-{
-	const char *s1 = v1;
-	const char *s2 = v2;
-	return strcmp(s1, s2);
-}
-
-static const char *
-propose_destinations(struct station *st, const char *to)
-{
-	to = station_verify_code(to);
-	if (to != NULL)
-		return to;
-
-	const size_t sz = st->deps->size;
-	const char **codes = calloc(sz, sizeof(char*));
-
-	size_t i = 0;
-	struct departure* dep;
-	SLIST_FOREACH(dep, st->deps->list, entries) {
-		codes[i++] = dep->code;
-	}
-
-	qsort(codes, sz, sizeof(char*), compare);
-
-	size_t uniq_count = 0;
-	const char *prev = NULL;
-	for (i = 0; i < sz; i++) {
-		if (prev == NULL || strcmp(prev, codes[i]) != 0) {
-			uniq_count++;
-			prev = codes[i];
-		}
-	}
-
-	if (uniq_count == 1)
-		return codes[0];
-
-	printf("Multiple destinantions found.\nUse -t parameter and station code from the list:\n");
-	prev = NULL;
-	for (i = 0; i < sz; i++) {
-		if (prev == NULL || strcmp(prev, codes[i]) != 0) {
-			printf("%-20s %s\n", station_name(codes[i]), codes[i]);
-			prev = codes[i];
-		}
-	}
-	return NULL;
-}
-
-static void
-parse_par(char *text, size_t len, char **stop_name, char **stop_status)
-{
-	regex_t p1, p2;
-	regmatch_t m1, m2;
-
-	int rc = regcomp(&p1, "<p[^>]*>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p1);
-
-	rc = regcomp(&p2, "</p>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p2);
-
-	m1.rm_so = 0;
-	m1.rm_eo = len;
-
-	rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
-
-	if (rc == REG_NOMATCH)
-		return;
-
-	if (rc != 0)
-		print_rex_error(rc, &p1);
-
-	m2.rm_so = m1.rm_eo;
-	m2.rm_eo = len;
-
-	rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
-
-	if (rc == REG_NOMATCH)
-		return;
-
-	if (rc != 0)
-		print_rex_error(rc, &p2);
-
-
-	size_t plen = m2.rm_so - m1.rm_eo;
-	char* ptext = &text[m1.rm_eo];
-	if (debug)
-		fprintf(log, "  p raw: %.*s\n", (int)plen, ptext);
-	char *p = strstr(ptext, "&nbsp;&nbsp;");
-	if (p != NULL)
-		memset(p, 0, 12);
-
-	*stop_name = ptext;
-	*stop_status = p + 12;
-	text[m2.rm_so] = 0;
-
-	if (debug)
-		fprintf(log, "stop_name: %s, stop_status: %s\n", *stop_name, *stop_status);
-}
-
-static void
-parse_train_stops(const char *fname, struct stop_list* list)
-{
-	int rc;
-	regex_t p1, p2;
-	regmatch_t m1, m2;
-	char *text;
-	size_t len;
-
-	rc = read_text(fname, &text, &len);
-	if (rc != 0)
-		err(rc, "cannot read file");
-
-	rc = regcomp(&p1, "<tr[^>]*>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p1);
-
-	rc = regcomp(&p2, "</tr>", REG_EXTENDED);
-	if (rc != 0)
-		print_rex_error(rc, &p2);
-
-	m1.rm_so = 0;
-	m1.rm_eo = len;
-
-	struct stop *last = NULL;
-
-	for (;;)
-	{
-		rc = regexec(&p1, text, 1, &m1, REG_STARTEND);
-
-		if (rc == REG_NOMATCH)
-			break;
-
-		if (rc != 0)
-			print_rex_error(rc, &p1);
-
-		m2.rm_so = m1.rm_eo;
-		m2.rm_eo = len;
-
-		rc = regexec(&p2, text, 1, &m2, REG_STARTEND);
-
-		if (rc == REG_NOMATCH)
-			break;
-
-		if (rc != 0)
-			print_rex_error(rc, &p2);
-
-
-		size_t tdlen = m2.rm_so - m1.rm_eo;
-		if (debug)
-			fprintf(log, "tr: %.*s\n", (int)tdlen, &text[m1.rm_eo]);
-
-		char *name = NULL;
-		char *status = NULL;
-
-		parse_par(&text[m1.rm_eo], tdlen, &name, &status);
-
-		if (name != NULL) {
-			struct stop *stop = calloc(1, sizeof(struct stop));
-
-			stop->name = name;
-			stop->code = station_code(stop->name);
-			stop->status = status;
-
-			if (SLIST_EMPTY(list))
-				SLIST_INSERT_HEAD(list, stop, entries);
-			else
-				SLIST_INSERT_AFTER(last, stop, entries);
-
-			last = stop;
-		}
-
-		m1.rm_so = m2.rm_eo;
-		m1.rm_eo = len;
-	}
-
-	regfree(&p1);
-	regfree(&p2);
-}
-
-static size_t
-get_prev_stations(const char *from_code, const char *train, struct stop_list *list)
-{
-	char fname[PATH_MAX];
-	char url[100];
-	const char *prefix = "";
-	const char *api_url = "http://dv.njtransit.com/mobile/train_stops.aspx?sid=%s&train=%s%s";
-
-	snprintf(fname, PATH_MAX, "/tmp/njtransit-train-%s-%s.html", from_code, train);
-
-	if (!debug) {
-		if (strlen(train) == 2)
-			prefix = "00";
-
-		snprintf(url, 100, api_url, from_code, prefix, train);
-
-		if (expired(fname)) {
-			struct httpreq_opts opts = {
-				.resp_fname = fname
-			};
-			if (httpreq(url, NULL, &opts) != 0)
-				return -1;
-		}
-	}
-
-	parse_train_stops(fname, list);
-
-	if (debug) {
-		struct stop *stop;
-		SLIST_FOREACH(stop, list, entries) {
-			printf("stop: %s(%s), %s\n", stop->name, stop->code, stop->status);
-		}
-	}
-
-	return 0;
-}
-
-static struct stop *
-stop_find(struct stop_list *list, const char *station_code)
-{
-	struct stop *stop;
-
-	SLIST_FOREACH(stop, list, entries) {
-		if (strcmp(stop->code, station_code) == 0)
-			return stop;
-	}
-
-	return NULL;
-}
-
-static struct stop_list *
-reversed(struct stop_list *list)
-{
-	struct stop *stop, *newstop;
-	struct stop_list *nl = calloc(1, sizeof(struct stop_list));
-
-	SLIST_FOREACH(stop, list, entries) {
-		newstop = calloc(1, sizeof(struct stop));
-		memcpy(newstop, stop, sizeof(struct stop));
-		SLIST_INSERT_HEAD(nl, newstop, entries);
-	}
-
-	return nl;
-}
-
+/* the clock stops at H:MM today, so reports of saved pages don't depend on the time of day */
 static int
-departures_get_upcoming(const char* from_code, const char *dest_code, struct buf *b)
+clock_set(const char *s)
 {
-	struct station *st = station_create(from_code);
-	if (debug)
-		station_dump(st);
-
-	dest_code = propose_destinations(st, dest_code);
+	struct tm tm;
+	time_t t = time(NULL);
+	int h, m;
 
-	if (dest_code == NULL)
-		return 1;
-
-	size_t n_next_trains = departures_calculate_next(st->deps, dest_code);
-	if (n_next_trains == 0)
-		errx(1, "No next trains to %s(%s) found", station_name(dest_code), dest_code);
-
-	if (debug)
-		printf("number of next trains to %s: %zu\n", dest_code, n_next_trains);
-
-	size_t i = 0, n = 0;
-	char s[1024];
-	size_t sz = sizeof(s);
-
-	const char *dest_name = station_name(dest_code);
-	const char *from_name = station_name(from_code);
-
-	struct departure *dep = SLIST_FIRST(st->deps->list);
-
-	if (debug)
-		printf("previous stations list:\n");
-
-	n = snprintf(s, sz, "\nTrains from %s to %s:\n\n", from_name, dest_name);
-	buf_append(b, s, n);
-
-	while (i < n_next_trains) {
-
-		if (dep->next == 0) {
-			dep = SLIST_NEXT(dep, entries);
-			continue;
-		}
-
-		if (debug)
-			printf("get status for next train %s to %s, idx: %zu\n", dep->train, dest_code, dep->next);
-
-		n = snprintf(s, sz, "%s #%s, Track %s",
-			dep->time, dep->train, dep->track);
-		buf_append(b, s, n);
-
-		if (dep->status != NULL && strlen(dep->status) > 0) {
-			buf_append(b, " ", 1);
-			buf_append(b, dep->status, strlen(dep->status));
-		}
-		buf_append(b, ".", 1);
-
-		struct stop_list *route = calloc(1, sizeof(struct stop_list));
-
-		get_prev_stations(from_code, dep->train, route);
-
-		if (SLIST_EMPTY(route)) {
-			n = snprintf(s, sz, "No route found for train %s from %s to %s\n", dep->train, from_code, dest_code);
-			buf_append(b, s, n);
-			dep = SLIST_NEXT(dep, entries);
-			i++;
-			continue;
-		}
+	if (sscanf(s, "%d:%d", &h, &m) != 2 || h < 0 || h > 23 || m < 0 || m > 59)
+		return -1;
 
-		struct stop_list *rev_route = reversed(route);
-
-		/* extract to separate method */
-		struct stop *origin_stop = stop_find(rev_route, from_code);
-		if (origin_stop == NULL)
-			errx(1, "Strange that cannot get origin stop code from reversed route");
-
-		struct stop *stop = SLIST_NEXT(origin_stop, entries);
-
-		const char *negative = " No previous stops status.\n";
-		bool appended = false;
-
-		while (stop != NULL) {
-
-			struct station *st = station_create(stop->code);
-
-			if (st == NULL) {
-				fprintf(stderr, "Cannot get departures for station code %s\n", stop->code);
-				return 1;
-			}
-
-			if (debug)
-				station_dump(st);
-
-			appended |= train_append_status(b, st, dep->train, appended);
-
-			stop = SLIST_NEXT(stop, entries);
-			station_destroy(st);
-		}
-		/* == */
-
-		if (!appended)
-			buf_append(b, negative, strlen(negative));
-
-		buf_append(b, "\n", 1);
-
-		dep = SLIST_NEXT(dep, entries);
-		i++;
-		if (i > 2)
-			break; // max 2 next trains
-	}
-
-	buf_append(b, credits, sz_credits - 1);
+	localtime_r(&t, &tm);
+	tm.tm_hour = h;
+	tm.tm_min = m;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	clock_replay(mktime(&tm));
 
 	return 0;
 }
@@ -772,12 +201,18 @@ int main(int argc, char **argv)
 
 	int ch;
 
-	while ((ch = getopt_long(argc, argv, "lhdsmvaf:t:p:", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "lhdsmvac:A:f:t:p:F:S:w:M:P:o:n:W:B:G:T:D:N:I:C:R:L:Z:K:Y:X:", longopts, NULL)) != -1) {
 		switch (ch) {
 			case 'd':
 				debug = 1;
-				log = fopen("/tmp/departures-debug.log", "wt");
-				fprintf(log, "==================\n\n\n\n\n\n\n");
+				break;
+			case 's':
+				debug_server = 1;
+				use_debug_server();
+				break;
+			case 'c':
+				if (clock_set(optarg) != 0)
+					errx(1, "Invalid time %s", optarg);
 				break;
 			case 'm':
 				email = 1;
@@ -786,16 +221,95 @@ int main(int argc, char **argv)
 				all = 1;
 				break;
 			case 'l':
-				stations_list();
+				stations_list(stdout);
 				return 0;
 			case 'f':
-				station_from = optarg;
+				if (n_from == MAX_ORIGINS)
+					errx(1, "At most %d origins are supported", MAX_ORIGINS);
+				station_from[n_from] = station_find(optarg);
+				if (station_from[n_from] == STATION_NONE)
+					errx(1, "Unknown station %s", optarg);
+				n_from++;
+				break;
+			case 'A':
+				arrivals_at = station_find(optarg);
+				if (arrivals_at == STATION_NONE)
+					errx(1, "Unknown station %s", optarg);
 				break;
 			case 'p':
 				train = optarg;
 				break;
 			case 't':
-				station_to = optarg;
+				station_to = station_find(optarg);
+				break;
+			case 'F':
+				if (report_format_parse(optarg, &format) != 0)
+					errx(1, "Unknown format %s", optarg);
+				break;
+			case 'S':
+				serve_port = optarg;
+				break;
+			case 'w':
+				workers = atoi(optarg);
+				break;
+			case 'M':
+				mem_set_budget((size_t)atoi(optarg) << 20);
+				break;
+			case 'P':
+				prefetch_file = optarg;
+				break;
+			case 'o':
+				filter.offset = atoi(optarg);
+				break;
+			case 'n':
+				filter.limit = atoi(optarg);
+				break;
+			case 'W':
+				filter.window = atoi(optarg);
+				break;
+			case 'B':
+				bench_rounds = atoi(optarg);
+				if (bench_rounds <= 0)
+					errx(1, "Invalid number of rounds %s", optarg);
+				break;
+			case 'G':
+				gtfs_zip = optarg;
+				break;
+			case 'T':
+				schedule_file = optarg;
+				break;
+			case 'D':
+				query_deadline_set(atoi(optarg));
+				break;
+			case 'N':
+				peers = optarg;
+				break;
+			case 'I':
+				self = optarg;
+				break;
+			case 'C':
+				page_dir = optarg;
+				break;
+			case 'L':
+				log_fname = optarg;
+				break;
+			case 'Z':
+				archive_dir = optarg;
+				break;
+			case 'K':
+				dict_dir = optarg;
+				break;
+			case 'Y':
+				replay_dir = optarg;
+				break;
+			case 'X':
+				replay_speed = atof(optarg);
+				if (replay_speed < 0)
+					errx(1, "Invalid speed %s", optarg);
+				break;
+			case 'R':
+				if (trace_open(optarg) != 0)
+					err(1, "Cannot create trace %s", optarg);
 				break;
 			case 'h':
 				usage();
@@ -809,28 +323,143 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (gtfs_zip != NULL)
+		return schedule_import(gtfs_zip, schedule_file);
+
+	/* -d logs every row, to the file of -L if given */
+	if ((debug || log_fname != NULL) &&
+	    log_open(log_fname != NULL ? log_fname : DEBUG_LOG, debug ? LEVEL_DEBUG : LEVEL_INFO) != 0)
+		err(1, "Cannot open log %s", log_fname != NULL ? log_fname : DEBUG_LOG);
+
+	if ((peers != NULL) != (self != NULL))
+		errx(1, "Cluster needs both peers and self");
+
+	if (peers != NULL && cluster_init(peers, self) != 0)
+		errx(1, "Invalid cluster %s, self %s", peers, self);
+
+	/* lateness is shown only when there is a timetable */
+	schedule_open(schedule_file);
+
+	if (bench_rounds > 0) {
+		if (optind == argc)
+			errx(1, "Page directory is not specified");
+		return bench_run(argv + optind, argc - optind, bench_rounds);
+	}
+
+	if (dict_dir != NULL)
+		return archive_train(dict_dir, argv + optind, argc - optind);
+
+	if (replay_dir != NULL)
+		return archive_replay(replay_dir, replay_speed, station_from, n_from, station_to, format, &filter);
+
+	if (archive_dir != NULL && archive_open(archive_dir) != 0)
+		err(1, "Cannot open archive %s", archive_dir);
+
+	/* the server starts a deadline per request */
+	query_begin();
+
 	const char *path = getenv("PATH_INFO");
 //	const char *http_method = getenv("HTTP_METHOD");
 
+	curl_global_init(CURL_GLOBAL_ALL);
+
 	if (path != NULL) {
-		if (strcmp(path, "/help") == 0) {
-			printf("help");
+		struct api_reply r;
+
+		api_handle(path, &r);
+		printf("Status: %d\r\nContent-Type: %s\r\n\r\n%s",
+			r.status, r.content_type, r.body.s != NULL ? r.body.s : "");
+		api_reply_free(&r);
+		curl_global_cleanup();
+		return 0;
+	}
+
+	if (serve_port != NULL) {
+		if (prefetch_file != NULL)
+			prefetch_start(prefetch_file);
+		arrivals_start();
+		cluster_poll_start();
+
+		int rc = server_run(serve_port, workers);
+		curl_global_cleanup();
+		return rc;
+	}
+
+	if (prefetch_file != NULL) {
+		int rc = prefetch_run(prefetch_file);
+		curl_global_cleanup();
+		return rc;
+	}
+
+	if (all) {
+		station_id ids[STATION_NONE];
+		size_t n = 0;
+
+		for (; n < n_from; n++)
+			ids[n] = station_from[n];
+
+		for (; optind < argc && n < STATION_NONE; optind++) {
+			ids[n] = station_find(argv[optind]);
+			if (ids[n] == STATION_NONE)
+				errx(1, "Unknown station %s", argv[optind]);
+			n++;
 		}
 
-		return 1;
+		if (n == 0)
+			errx(1, "Station is not specified");
+
+		filter.now = clock_now();
+		int rc = report_stream(ids, n, format, &filter, stdout);
+		curl_global_cleanup();
+		return rc;
 	}
 
-	if (station_from == NULL)
-		errx(1, "Origin station is not specified");
+	if (arrivals_at != STATION_NONE) {
+		struct buf b;
+		struct station *st;
+		station_id id = arrivals_at;
 
-	curl_global_init(CURL_GLOBAL_ALL);
+		memset(&b, 0, sizeof(struct buf));
+
+		for (;;) {
+			st = board_get(id);
+			if (st == NULL)
+				warnx("Cannot get departures for %s", station_code(id));
+			else
+				arrivals_index(st);
+			board_release(st);
+
+			if (optind == argc)
+				break;
+			id = station_find(argv[optind]);
+			if (id == STATION_NONE)
+				errx(1, "Unknown station %s", argv[optind]);
+			optind++;
+		}
+
+		filter.now = clock_now();
+		arrivals_render(arrivals_at, format, &filter, &b);
+		printf("%s%s", b.s != NULL ? b.s : "", format == FORMAT_JSON ? "\n" : "");
+		free(b.s);
+		curl_global_cleanup();
+		return 0;
+	}
+
+	if (n_from == 0)
+		errx(1, "Origin station is not specified");
 
 	struct buf b;
 	memset(&b, 0, sizeof(struct buf));
 
-	if (departures_get_upcoming(station_from, station_to, &b) == 0) {
-		buf_appendf(&b, "\n\ndepartures %s(%s) at host: %s, user: %s\n",
-			    app_version, app_date, getenv("HOST"), getenv("USER"));
+	int rc = departures_render(station_from, n_from, station_to, format, &b);
+	if ((rc != 0 || format == FORMAT_JSON) && b.s != NULL)
+		printf("%s%s", b.s, format == FORMAT_JSON ? "\n" : "");
+
+	if (rc == 0 && format == FORMAT_TEXT) {
+		/* the output of the debug server is compared with tests/ */
+		if (!debug_server)
+			buf_appendf(&b, "\n\ndepartures %s(%s) at host: %s, user: %s\n",
+				    app_version, app_date, getenv("HOST"), getenv("USER"));
 		printf("%s", b.s);
 
 		if (email) {
@@ -844,7 +473,7 @@ int main(int argc, char **argv)
 			char fname[PATH_MAX];
 			snprintf(fname, PATH_MAX, "%s/.config/departures/smtp.txt", getenv("HOME"));
 
-			int rc = send_email(&m, fname);
+			rc = send_email(&m, fname);
 
 			if (rc != 0)
 				return 1;
@@ -852,6 +481,6 @@ int main(int argc, char **argv)
 	}
 
 	curl_global_cleanup();
-	return 0;
+	return rc;
 }
 
@@ -0,0 +1,311 @@
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "events.h"
+#include "json.h"
+#include "report.h"
+
+#define EVENTS_POLL             10      /* seconds between board checks */
+#define EVENTS_KEEPALIVE        30      /* seconds between keepalives */
+#define EVENTS_MAX_TOPICS       64
+#define EVENTS_SNAPSHOT_WAIT    5       /* seconds the first board may take to send */
+
+struct subscriber
+{
+	int                     fd;             /* client socket */
+	LIST_ENTRY(subscriber)  entries;        /* handler for list */
+};
+
+LIST_HEAD(subscriber_list, subscriber);
+
+struct topic
+{
+	station_id              id;             /* station */
+	struct station          *last;          /* board the subscribers have seen */
+	time_t                  sent;           /* time of the last write */
+	struct subscriber_list  subs;           /* subscribers */
+	LIST_ENTRY(topic)       entries;        /* handler for list */
+};
+
+/* rows of a board diff appended as events */
+struct diff_out
+{
+	struct buf              *b;             /* events */
+	time_t                  loaded;         /* time the new board was parsed */
+};
+
+static LIST_HEAD(topic_list, topic) topics = LIST_HEAD_INITIALIZER(topics);
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t events_once = PTHREAD_ONCE_INIT;
+
+static int
+send_all(int fd, const char *s, size_t len, int flags)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, s, len, flags);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		s += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* non-blocking write, a subscriber that can't keep up is dropped */
+static int
+send_event(int fd, const char *s, size_t len)
+{
+	return send_all(fd, s, len, MSG_DONTWAIT);
+}
+
+static void
+topic_send(struct topic *t, const char *s, size_t len)
+{
+	struct subscriber *sub, *next;
+
+	for (sub = LIST_FIRST(&t->subs); sub != NULL; sub = next) {
+		next = LIST_NEXT(sub, entries);
+		if (send_event(sub->fd, s, len) != 0) {
+			LIST_REMOVE(sub, entries);
+			close(sub->fd);
+			free(sub);
+		}
+	}
+
+	t->sent = time(NULL);
+}
+
+static void
+append_row(void *arg, enum row_change change, const struct departure *dep)
+{
+	static const char *names[] = { "add", "change", "remove" };
+	struct diff_out *o = arg;
+	struct buf *b = o->b;
+	struct json j;
+
+	buf_appendf(b, "event: %s\ndata: ", names[change]);
+
+	json_init(&j, b);
+	if (change == ROW_REMOVED) {
+		json_begin_object(&j);
+		json_key(&j, "train");
+		json_string(&j, dep->train);
+		json_end_object(&j);
+	} else {
+		departure_json(&j, dep, o->loaded);
+	}
+
+	buf_append(b, "\n\n", 2);
+}
+
+static void
+append_board(struct buf *b, struct station *st)
+{
+	buf_appendf(b, "event: board\nid: %llu\ndata: ", (unsigned long long)st->version);
+	board_render(st, FORMAT_JSON, NULL, b);
+	buf_append(b, "\n\n", 2);
+}
+
+static struct topic *
+topic_find(station_id id)
+{
+	struct topic *t;
+
+	LIST_FOREACH(t, &topics, entries) {
+		if (t->id == id)
+			return t;
+	}
+
+	return NULL;
+}
+
+static void
+topic_update(station_id id)
+{
+	struct station *st = board_get(id);
+	struct topic *t;
+	struct buf b;
+	struct diff_out o = { &b, 0 };
+
+	pthread_mutex_lock(&events_lock);
+
+	t = topic_find(id);
+	if (t == NULL || st == NULL) {
+		pthread_mutex_unlock(&events_lock);
+		board_release(st);
+		return;
+	}
+
+	memset(&b, 0, sizeof(struct buf));
+
+	o.loaded = st->loaded;
+	if (st->version != t->last->version && board_diff(t->last, st, append_row, &o) > 0) {
+		buf_appendf(&b, "id: %llu\n\n", (unsigned long long)st->version);
+		topic_send(t, b.s, strlen(b.s));
+	} else if (t->sent + EVENTS_KEEPALIVE < time(NULL)) {
+		topic_send(t, ": keepalive\n\n", 13);
+	}
+
+	board_release(t->last);
+	t->last = st;
+
+	if (LIST_EMPTY(&t->subs)) {
+		LIST_REMOVE(t, entries);
+		board_release(t->last);
+		free(t);
+	}
+
+	pthread_mutex_unlock(&events_lock);
+	free(b.s);
+}
+
+static void *
+events_loop(void *arg)
+{
+	station_id ids[EVENTS_MAX_TOPICS];
+	struct topic *t;
+	size_t i, n;
+
+	for (;;) {
+		sleep(EVENTS_POLL);
+
+		/* boards are fetched without holding the lock */
+		n = 0;
+		pthread_mutex_lock(&events_lock);
+		LIST_FOREACH(t, &topics, entries) {
+			if (n < EVENTS_MAX_TOPICS)
+				ids[n++] = t->id;
+		}
+		pthread_mutex_unlock(&events_lock);
+
+		for (i = 0; i < n; i++)
+			topic_update(ids[i]);
+	}
+
+	return NULL;
+}
+
+static void
+events_start()
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, events_loop, NULL) != 0)
+		errx(1, "Cannot create events thread");
+
+	pthread_detach(thread);
+}
+
+/*
+ * Takes over the client socket: sends the event stream header and the
+ * current board, then adds the client to the station's subscribers. The
+ * board can be larger than the socket buffer, so it is sent blocking for
+ * at most EVENTS_SNAPSHOT_WAIT and without holding the lock; the changes
+ * made meanwhile are sent before the client joins the topic.
+ * Returns -1 if the socket is still owned by the caller, when the topic
+ * cap is reached or the board can't be loaded.
+ */
+int
+events_subscribe(int fd, station_id id)
+{
+	const char *head =
+		"HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/event-stream\r\n"
+		"Cache-Control: no-cache\r\n"
+		"\r\n";
+	struct timeval wait = { EVENTS_SNAPSHOT_WAIT, 0 };
+	struct station *st = NULL;
+	struct subscriber *sub;
+	struct topic *t;
+	struct buf b;
+	struct diff_out o = { &b, 0 };
+	size_t n = 0;
+	int rc;
+
+	pthread_once(&events_once, events_start);
+
+	pthread_mutex_lock(&events_lock);
+
+	t = topic_find(id);
+	if (t != NULL) {
+		st = t->last;
+		atomic_fetch_add(&st->refs, 1);
+	} else {
+		/* a new topic starts from the current board */
+		LIST_FOREACH(t, &topics, entries)
+			n++;
+	}
+
+	pthread_mutex_unlock(&events_lock);
+
+	if (st == NULL && (n >= EVENTS_MAX_TOPICS || (st = board_get(id)) == NULL))
+		return -1;
+
+	memset(&b, 0, sizeof(struct buf));
+	buf_append(&b, head, strlen(head));
+	append_board(&b, st);
+
+	rc = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait)) == 0 ? send_all(fd, b.s, strlen(b.s), 0) : -1;
+	free(b.s);
+
+	if (rc != 0) {
+		close(fd);
+		board_release(st);
+		return 0;
+	}
+
+	pthread_mutex_lock(&events_lock);
+
+	t = topic_find(id);
+	if (t == NULL) {
+		t = calloc(1, sizeof(struct topic));
+		if (t == NULL)
+			err(1, "Cannot allocate topic");
+		t->id = id;
+		t->last = st;
+		st = NULL;
+		LIST_INIT(&t->subs);
+		LIST_INSERT_HEAD(&topics, t, entries);
+	}
+
+	/* the topic moved on while the board was sent */
+	memset(&b, 0, sizeof(struct buf));
+	o.loaded = t->last->loaded;
+	if (st != NULL && st->version != t->last->version && board_diff(st, t->last, append_row, &o) > 0)
+		buf_appendf(&b, "id: %llu\n\n", (unsigned long long)t->last->version);
+
+	if (b.s == NULL || send_event(fd, b.s, strlen(b.s)) == 0) {
+		sub = calloc(1, sizeof(struct subscriber));
+		if (sub == NULL)
+			err(1, "Cannot allocate subscriber");
+
+		sub->fd = fd;
+		LIST_INSERT_HEAD(&t->subs, sub, entries);
+		t->sent = time(NULL);
+	} else {
+		close(fd);
+	}
+
+	pthread_mutex_unlock(&events_lock);
+
+	board_release(st);
+	free(b.s);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+/*
+ * Server-sent events. Subscribers of /v1/events/XX get the board once and
+ * then only the rows that changed between consecutive board versions.
+ * Every station is diffed once per version, whatever the subscriber count.
+ */
+
+int events_subscribe(int fd, station_id id);
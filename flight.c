@@ -0,0 +1,83 @@
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flight.h"
+
+struct flight
+{
+	char                    key[64];        /* coalescing key */
+	void                    *result;        /* leader's result */
+	int                     done;           /* result is ready */
+	int                     refs;           /* leader and waiters */
+	pthread_cond_t          cond;           /* signaled when done */
+	LIST_ENTRY(flight)      entries;        /* handler for list */
+};
+
+static void
+flight_unref(struct flight *f)
+{
+	if (--f->refs > 0)
+		return;
+
+	pthread_cond_destroy(&f->cond);
+	free(f);
+}
+
+void *
+flight_do(struct flight_group *g, const char *key,
+	  void *(*fn)(const char *key, void *arg), void *arg,
+	  void (*share)(void *result))
+{
+	struct flight *f;
+	void *result;
+	int waiters;
+
+	pthread_mutex_lock(&g->lock);
+
+	LIST_FOREACH(f, &g->calls, entries) {
+		if (strcmp(f->key, key) == 0)
+			break;
+	}
+
+	if (f != NULL) {
+		f->refs++;
+		while (!f->done)
+			pthread_cond_wait(&f->cond, &g->lock);
+		result = f->result;
+		flight_unref(f);
+		pthread_mutex_unlock(&g->lock);
+		return result;
+	}
+
+	f = calloc(1, sizeof(struct flight));
+	if (f == NULL)
+		err(1, "Cannot allocate flight");
+
+	strncpy(f->key, key, sizeof(f->key) - 1);
+	f->refs = 1;
+	pthread_cond_init(&f->cond, NULL);
+	LIST_INSERT_HEAD(&g->calls, f, entries);
+
+	pthread_mutex_unlock(&g->lock);
+
+	result = fn(key, arg);
+
+	pthread_mutex_lock(&g->lock);
+
+	LIST_REMOVE(f, entries);
+	f->result = result;
+	f->done = 1;
+
+	if (result != NULL && share != NULL) {
+		for (waiters = f->refs - 1; waiters > 0; waiters--)
+			share(result);
+	}
+
+	pthread_cond_broadcast(&f->cond);
+	flight_unref(f);
+
+	pthread_mutex_unlock(&g->lock);
+
+	return result;
+}
@@ -0,0 +1,25 @@
+#include <pthread.h>
+#include <sys/queue.h>
+
+/*
+ * Single-flight call coalescing. Concurrent flight_do() calls with the same
+ * key run fn once; the other callers wait for it and get the same result.
+ * share() is called once per waiter, under the group lock, before the
+ * leader returns, so a reference counted result can't be freed under them.
+ */
+
+struct flight;
+
+LIST_HEAD(flight_list, flight);
+
+struct flight_group
+{
+	pthread_mutex_t         lock;   /* protects calls */
+	struct flight_list      calls;  /* calls in flight */
+};
+
+#define FLIGHT_GROUP_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, LIST_HEAD_INITIALIZER(calls) }
+
+void *flight_do(struct flight_group *g, const char *key,
+		void *(*fn)(const char *key, void *arg), void *arg,
+		void (*share)(void *result));
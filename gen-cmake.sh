@@ -2,6 +2,9 @@ SRCDIR=$HOME/src/xtree/departures
 BDIR=$HOME/b/departures
 OS=$(uname)
 
+# -r also generates the release build in ${BDIR}r
+RELEASE="-DCMAKE_BUILD_TYPE=Release -DLTO=ON"
+
 if [ "_$OS" == "_Darwin" ] ; then
 	rm -rf ${BDIR}x
 	mkdir -p ${BDIR}x
@@ -12,9 +15,23 @@ if [ "_$OS" == "_Darwin" ] ; then
 	mkdir -p ${BDIR}b
 	cd ${BDIR}b
 	cmake -DCMAKE_BUILD_TYPE=DEBUG -DCMAKE_TOOLCHAIN_FILE=$SRCDIR/macports.cmake $SRCDIR
+
+	if [ x$1 == "x-r" ]; then
+		rm -rf ${BDIR}r
+		mkdir -p ${BDIR}r
+		cd ${BDIR}r
+		cmake $RELEASE -DCMAKE_TOOLCHAIN_FILE=$SRCDIR/macports.cmake $SRCDIR
+	fi
 else
 	rm -rf ${BDIR}b
 	mkdir -p ${BDIR}b
 	cd ${BDIR}b
 	cmake -DCMAKE_BUILD_TYPE=DEBUG $SRCDIR
+
+	if [ x$1 == "x-r" ]; then
+		rm -rf ${BDIR}r
+		mkdir -p ${BDIR}r
+		cd ${BDIR}r
+		cmake $RELEASE $SRCDIR
+	fi
 fi
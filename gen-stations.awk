@@ -0,0 +1,65 @@
+# Generates stations_defs.c from stations.txt.
+#
+# usage: awk -f gen-stations.awk stations.txt > stations_defs.c
+
+BEGIN {
+	FS = "\t"
+	n = 0
+	ns = 0
+}
+
+/^#/ || NF == 0 {
+	next
+}
+
+{
+	if ($1 in ids) {
+		printf("%s:%d: duplicate station code %s\n", FILENAME, FNR, $1) > "/dev/stderr"
+		exit 1
+	}
+
+	ids[$1] = n
+	code[n] = $1
+	name[n] = $2
+
+	nl = split($3, l, ",")
+	line[n] = nl > 0 ? "" : "0"
+	for (i = 1; i <= nl; i++)
+		line[n] = line[n] (i > 1 ? " | " : "") "LINE_" l[i]
+
+	if (NF >= 4 && $4 != "") {
+		k = split($4, s, "|")
+		for (i = 1; i <= k; i++) {
+			syn[ns] = s[i]
+			synid[ns] = n
+			ns++
+		}
+	}
+
+	n++
+}
+
+END {
+	if (n >= 255) {
+		printf("%s: too many stations for a one-byte id\n", FILENAME) > "/dev/stderr"
+		exit 1
+	}
+
+	print "/* Generated by gen-stations.awk from stations.txt. Do not edit. */"
+	print ""
+	print "#include \"stations.h\""
+	print ""
+	print "const struct station_def station_defs[] = {"
+	for (i = 0; i < n; i++)
+		printf("\t{ \"%s\", \"%s\", %s },\n", code[i], name[i], line[i])
+	print "};"
+	print ""
+	printf("const size_t n_stations = %d;\n", n)
+	print ""
+	print "const struct station_synonym station_synonyms[] = {"
+	for (i = 0; i < ns; i++)
+		printf("\t{ \"%s\", %d }, /* %s */\n", syn[i], synid[i], code[synid[i]])
+	print "};"
+	print ""
+	printf("const size_t n_synonyms = %d;\n", ns)
+}
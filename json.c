@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "common/net.h"
+#include "json.h"
+
+void
+json_init(struct json *j, struct buf *b)
+{
+	memset(j, 0, sizeof(struct json));
+	j->b = b;
+	j->first[0] = 1;
+}
+
+/* writes the comma before a value unless it follows a key */
+static void
+json_sep(struct json *j)
+{
+	if (j->key) {
+		j->key = 0;
+		return;
+	}
+
+	if (!j->first[j->depth])
+		buf_append(j->b, ",", 1);
+
+	j->first[j->depth] = 0;
+}
+
+static void
+json_open(struct json *j, const char *ch)
+{
+	json_sep(j);
+	buf_append(j->b, ch, 1);
+
+	if (j->depth + 1 < JSON_MAX_DEPTH)
+		j->depth++;
+
+	j->first[j->depth] = 1;
+}
+
+static void
+json_close(struct json *j, const char *ch)
+{
+	buf_append(j->b, ch, 1);
+
+	if (j->depth > 0)
+		j->depth--;
+}
+
+void
+json_begin_object(struct json *j)
+{
+	json_open(j, "{");
+}
+
+void
+json_end_object(struct json *j)
+{
+	json_close(j, "}");
+}
+
+void
+json_begin_array(struct json *j)
+{
+	json_open(j, "[");
+}
+
+void
+json_end_array(struct json *j)
+{
+	json_close(j, "]");
+}
+
+static void
+json_escape(struct json *j, const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *run = s;
+	char esc[6];
+	size_t i, n;
+
+	buf_append(j->b, "\"", 1);
+
+	for (i = 0; i < len; i++) {
+		unsigned char ch = s[i];
+
+		if (ch >= 0x20 && ch != '"' && ch != '\\')
+			continue;
+
+		if (&s[i] > run)
+			buf_append(j->b, run, &s[i] - run);
+		run = &s[i + 1];
+
+		n = 2;
+		esc[0] = '\\';
+		switch (ch) {
+		case '"':  esc[1] = '"';  break;
+		case '\\': esc[1] = '\\'; break;
+		case '\n': esc[1] = 'n';  break;
+		case '\r': esc[1] = 'r';  break;
+		case '\t': esc[1] = 't';  break;
+		default:
+			memcpy(esc, "\\u00", 4);
+			esc[4] = hex[ch >> 4];
+			esc[5] = hex[ch & 15];
+			n = 6;
+		}
+		buf_append(j->b, esc, n);
+	}
+
+	if (&s[len] > run)
+		buf_append(j->b, run, &s[len] - run);
+
+	buf_append(j->b, "\"", 1);
+}
+
+void
+json_key(struct json *j, const char *key)
+{
+	json_sep(j);
+	json_escape(j, key, strlen(key));
+	buf_append(j->b, ":", 1);
+	j->key = 1;
+}
+
+void
+json_stringn(struct json *j, const char *s, size_t len)
+{
+	json_sep(j);
+	json_escape(j, s, len);
+}
+
+void
+json_string(struct json *j, const char *s)
+{
+	if (s == NULL) {
+		json_null(j);
+		return;
+	}
+
+	json_stringn(j, s, strlen(s));
+}
+
+void
+json_int(struct json *j, long long v)
+{
+	char s[24];
+	int n = snprintf(s, sizeof(s), "%lld", v);
+
+	json_sep(j);
+	buf_append(j->b, s, n);
+}
+
+void
+json_bool(struct json *j, int v)
+{
+	json_sep(j);
+	if (v)
+		buf_append(j->b, "true", 4);
+	else
+		buf_append(j->b, "false", 5);
+}
+
+void
+json_null(struct json *j)
+{
+	json_sep(j);
+	buf_append(j->b, "null", 4);
+}
@@ -0,0 +1,28 @@
+/*
+ * Streaming JSON writer. Values are escaped straight into the output
+ * buffer; the writer keeps only a comma flag per nesting level.
+ */
+
+#define JSON_MAX_DEPTH  16
+
+struct buf;
+
+struct json
+{
+	struct buf      *b;                     /* output buffer */
+	int             depth;                  /* current nesting level */
+	unsigned char   first[JSON_MAX_DEPTH];  /* nothing written yet at level */
+	int             key;                    /* a key was just written */
+};
+
+void json_init(struct json *j, struct buf *b);
+void json_begin_object(struct json *j);
+void json_end_object(struct json *j);
+void json_begin_array(struct json *j);
+void json_end_array(struct json *j);
+void json_key(struct json *j, const char *key);
+void json_string(struct json *j, const char *s);
+void json_stringn(struct json *j, const char *s, size_t len);
+void json_int(struct json *j, long long v);
+void json_bool(struct json *j, int v);
+void json_null(struct json *j);
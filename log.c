@@ -0,0 +1,223 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#define LOG_SLOTS       4096            /* records in the ring, a power of 2 */
+#define LOG_KEY         32
+#define LOG_IDLE_MS     10              /* writer sleep when the ring is empty */
+
+/*
+ * A slot is free for the producer claiming position pos when its seq is
+ * pos, and holds a record for the writer when its seq is pos + 1
+ * (Vyukov's bounded queue).
+ */
+struct log_record
+{
+	atomic_size_t   seq;
+	struct timespec ts;
+	enum log_level  level;
+	int             tid;
+	const char      *event;                 /* static string */
+	char            key[LOG_KEY];
+	long long       n;
+	size_t          len;                    /* of the logged text, maybe cut */
+	char            text[LOG_TEXT];
+};
+
+enum log_level log_level = LEVEL_OFF;
+
+static struct log_record ring[LOG_SLOTS];
+static atomic_size_t head;              /* next position to claim */
+static size_t tail;                     /* next position to write, under drain_lock */
+static atomic_size_t dropped;           /* records lost to a full ring */
+static FILE *log_file;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int threads;
+static _Thread_local int tid;
+
+static const char *level_names[] = { "debug", "info", "warn" };
+
+static void
+log_write(struct log_record *r)
+{
+	struct tm tm;
+	size_t len = r->len < LOG_TEXT ? r->len : LOG_TEXT, i;
+
+	localtime_r(&r->ts.tv_sec, &tm);
+	fprintf(log_file, "%02d:%02d:%02d.%06ld %-5s %2d %s", tm.tm_hour, tm.tm_min, tm.tm_sec,
+		r->ts.tv_nsec / 1000, level_names[r->level], r->tid, r->event);
+	if (r->key[0] != 0)
+		fprintf(log_file, " %s", r->key);
+	if (r->n != LOG_NONE)
+		fprintf(log_file, " %lld", r->n);
+	if (r->len > 0) {
+		/* one line per record */
+		fputs(" | ", log_file);
+		for (i = 0; i < len; i++)
+			fputc(r->text[i] == '\n' || r->text[i] == '\r' ? ' ' : r->text[i], log_file);
+		if (r->len > LOG_TEXT)
+			fputs("...", log_file);
+	}
+	fputc('\n', log_file);
+}
+
+/* writes the records logged so far, returns their number */
+static size_t
+log_drain()
+{
+	struct log_record *r;
+	size_t n = 0, lost;
+
+	pthread_mutex_lock(&drain_lock);
+
+	for (;;) {
+		r = &ring[tail % LOG_SLOTS];
+		if (atomic_load_explicit(&r->seq, memory_order_acquire) != tail + 1)
+			break;
+
+		log_write(r);
+		atomic_store_explicit(&r->seq, tail + LOG_SLOTS, memory_order_release);
+		tail++;
+		n++;
+	}
+
+	lost = atomic_exchange(&dropped, 0);
+	if (lost > 0)
+		fprintf(log_file, "log: dropped %zu records\n", lost);
+
+	if (n > 0 || lost > 0)
+		fflush(log_file);
+
+	pthread_mutex_unlock(&drain_lock);
+
+	return n;
+}
+
+static void *
+log_loop(void *arg)
+{
+	struct timespec idle = { 0, LOG_IDLE_MS * 1000000L };
+
+	for (;;) {
+		if (log_drain() == 0)
+			nanosleep(&idle, NULL);
+	}
+
+	return NULL;
+}
+
+static void
+log_flush()
+{
+	log_drain();
+}
+
+/*
+ * Starts writing records of the level and above to fname. Returns -1 if
+ * the file can't be created.
+ */
+int
+log_open(const char *fname, enum log_level level)
+{
+	pthread_t thread;
+	size_t i;
+
+	log_file = fopen(fname, "at");
+	if (log_file == NULL)
+		return -1;
+
+	for (i = 0; i < LOG_SLOTS; i++)
+		atomic_init(&ring[i].seq, i);
+
+	if (pthread_create(&thread, NULL, log_loop, NULL) != 0) {
+		fclose(log_file);
+		return -1;
+	}
+
+	pthread_detach(thread);
+	atexit(log_flush);
+	log_level = level;
+
+	return 0;
+}
+
+/* claims the next free slot, NULL if the ring is full */
+static struct log_record *
+log_claim()
+{
+	struct log_record *r;
+	size_t pos = atomic_load_explicit(&head, memory_order_relaxed), seq;
+
+	for (;;) {
+		r = &ring[pos % LOG_SLOTS];
+		seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+								  memory_order_relaxed, memory_order_relaxed))
+				return r;
+		} else if (seq < pos) {
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+}
+
+/* logs the event with the key, number and text that aren't NULL, LOG_NONE or empty */
+void
+log_add(enum log_level level, const char *event, const char *key, long long n,
+	const char *text, size_t len)
+{
+	struct log_record *r;
+	size_t pos;
+
+	if (level < log_level)
+		return;
+
+	r = log_claim();
+	if (r == NULL)
+		return;
+
+	if (tid == 0)
+		tid = atomic_fetch_add(&threads, 1) + 1;
+
+	clock_gettime(CLOCK_REALTIME, &r->ts);
+	r->level = level;
+	r->tid = tid;
+	r->event = event;
+	r->key[0] = 0;
+	if (key != NULL)
+		strncat(r->key, key, LOG_KEY - 1);
+	r->n = n;
+	r->len = len;
+	if (len > 0)
+		memcpy(r->text, text, len < LOG_TEXT ? len : LOG_TEXT);
+
+	/* the slot of position pos holds seq pos until published */
+	pos = atomic_load_explicit(&r->seq, memory_order_relaxed);
+	atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+}
+
+void
+log_msg(enum log_level level, const char *event, const char *key)
+{
+	log_add(level, event, key, LOG_NONE, NULL, 0);
+}
+
+void
+log_num(enum log_level level, const char *event, const char *key, long long n)
+{
+	log_add(level, event, key, n, NULL, 0);
+}
+
+void
+log_text(enum log_level level, const char *event, const char *key, const char *text, size_t len)
+{
+	log_add(level, event, key, LOG_NONE, text, len);
+}
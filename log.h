@@ -0,0 +1,34 @@
+#include <limits.h>
+#include <stddef.h>
+
+/*
+ * Asynchronous structured log.
+ *
+ * Records are copied into a lock-free ring buffer and written to the log
+ * file by a background thread, so a call costs a clock read and a short
+ * copy and logging can stay on in the server. When the ring is full new
+ * records are dropped and counted rather than waited for. Every line is
+ * "time level thread event [key] [n] [| text]"; the text is cut at
+ * LOG_TEXT bytes.
+ */
+
+enum log_level
+{
+	LEVEL_DEBUG,                    /* every parsed row */
+	LEVEL_INFO,                     /* cache and fetch decisions */
+	LEVEL_WARN,                     /* missing pages and unreachable peers */
+	LEVEL_OFF,
+};
+
+#define DEBUG_LOG       "/tmp/departures-debug.log"     /* log of -d runs */
+#define LOG_TEXT        240
+#define LOG_NONE        LLONG_MIN       /* record without a number */
+
+extern enum log_level log_level;        /* records below it are dropped */
+
+int log_open(const char *fname, enum log_level level);
+void log_add(enum log_level level, const char *event, const char *key, long long n,
+	     const char *text, size_t len);
+void log_msg(enum log_level level, const char *event, const char *key);
+void log_num(enum log_level level, const char *event, const char *key, long long n);
+void log_text(enum log_level level, const char *event, const char *key, const char *text, size_t len);
@@ -0,0 +1,89 @@
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "stations.h"
+#include "board.h"
+#include "mem.h"
+#include "rcu.h"
+#include "report.h"
+#include "render.h"
+
+static size_t budget = 0;
+static atomic_size_t used = 0;
+static atomic_size_t entries[MEM_CLASSES];
+static atomic_size_t bytes[MEM_CLASSES];
+static atomic_size_t evictions[MEM_CLASSES];
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+mem_set_budget(size_t n)
+{
+	budget = n;
+}
+
+void
+mem_charge(enum mem_class c, size_t n)
+{
+	atomic_fetch_add(&entries[c], 1);
+	atomic_fetch_add(&bytes[c], n);
+	atomic_fetch_add(&used, n);
+}
+
+void
+mem_uncharge(enum mem_class c, size_t n)
+{
+	atomic_fetch_sub(&entries[c], 1);
+	atomic_fetch_sub(&bytes[c], n);
+	atomic_fetch_sub(&used, n);
+}
+
+/*
+ * Evicts until the caches fit the budget. Rendered reports go first, they
+ * are rebuilt from boards without any I/O, then train stops, then boards.
+ * An evicted board or train is freed when its last reader releases it, so
+ * the bytes it will give back are counted as freed right away. One thread
+ * reclaims at a time, others skip.
+ */
+void
+mem_reclaim()
+{
+	size_t freed = 0, n;
+	int c;
+
+	if (budget == 0 || atomic_load(&used) <= budget)
+		return;
+
+	if (pthread_mutex_trylock(&reclaim_lock) != 0)
+		return;
+
+	for (c = MEM_RENDERED; c >= 0 && atomic_load(&used) > budget + freed; ) {
+		n = c == MEM_RENDERED ? render_evict() : c == MEM_STOPS ? train_stops_evict() : board_evict();
+		if (n == 0) {
+			c--;
+			continue;
+		}
+
+		atomic_fetch_add(&evictions[c], 1);
+		if (c != MEM_RENDERED)
+			freed += n;
+	}
+
+	pthread_mutex_unlock(&reclaim_lock);
+
+	rcu_reclaim();
+}
+
+void
+mem_stats_get(struct mem_stats *s)
+{
+	int c;
+
+	s->budget = budget;
+	s->used = atomic_load(&used);
+
+	for (c = 0; c < MEM_CLASSES; c++) {
+		s->entries[c] = atomic_load(&entries[c]);
+		s->bytes[c] = atomic_load(&bytes[c]);
+		s->evictions[c] = atomic_load(&evictions[c]);
+	}
+}
@@ -0,0 +1,33 @@
+#include <stddef.h>
+
+/*
+ * Memory budget for cached boards, train stops and rendered reports.
+ *
+ * Caches charge the bytes of every entry they allocate and give them back
+ * when it is freed. When the total is over the budget, mem_reclaim() asks
+ * the caches to evict entries that were not used since the last sweep
+ * (CLOCK) until it fits again. A zero budget means no limit.
+ */
+
+enum mem_class
+{
+	MEM_BOARDS,                     /* parsed station boards */
+	MEM_STOPS,                      /* parsed train stops */
+	MEM_RENDERED,                   /* rendered reports */
+	MEM_CLASSES,
+};
+
+struct mem_stats
+{
+	size_t          budget;                 /* bytes, 0 if unlimited */
+	size_t          used;                   /* bytes charged by all caches */
+	size_t          entries[MEM_CLASSES];   /* live entries */
+	size_t          bytes[MEM_CLASSES];     /* bytes of live entries */
+	size_t          evictions[MEM_CLASSES]; /* entries evicted over budget */
+};
+
+void mem_set_budget(size_t bytes);
+void mem_charge(enum mem_class c, size_t bytes);
+void mem_uncharge(enum mem_class c, size_t bytes);
+void mem_reclaim(void);
+void mem_stats_get(struct mem_stats *s);
@@ -2,6 +2,9 @@
 #include <memory.h>
 #include <err.h>
 #include <ctype.h>
+#include <stdlib.h>
+
+#define CHUNK_SIZE      1024
 
 void
 print_rex_error(int errcode, const regex_t *preg)
@@ -14,7 +17,7 @@ print_rex_error(int errcode, const regex_t *preg)
 }
 
 void
-trscanner_create(struct trscanner *s, char *text, int len)
+trscanner_create(struct trscanner *s, const char *text, int len)
 {
 	int rc;
 
@@ -68,27 +71,21 @@ trscanner_next(struct trscanner *s)
 
 	s->sbeg = &s->text[s->m1.rm_eo];
 	s->send = &s->text[s->m2.rm_so];
-	s->mlen = s->m2.rm_so - s->m1.rm_eo;
-	*s->send = 0;
 
 	/* skip space at start */
 
-	while (isspace(*s->sbeg)) {
+	while (s->sbeg < s->send && isspace(*s->sbeg))
 		s->sbeg++;
-		s->mlen--;
-	}
 
-	/* trim the end */
+	/* trim the markup and the space ending the text */
 
-	char *p = strchr(s->sbeg, '<');
+	const char *p = memchr(s->sbeg, '<', s->send - s->sbeg);
 	if (p == NULL)
 		p = s->send;
-
-	while (isspace(*p) || *p == '<') {
-		*p = 0;
-		s->mlen--;
+	while (p > s->sbeg && isspace(p[-1]))
 		p--;
-	}
+
+	s->mlen = p - s->sbeg;
 
 	s->m1.rm_so = s->m2.rm_eo;
 	s->m1.rm_eo = s->len;
@@ -96,3 +93,67 @@ trscanner_next(struct trscanner *s)
 	return 1;
 }
 
+struct strchunk
+{
+	struct strchunk *next;
+	size_t          used;
+	size_t          size;
+	char            data[];
+};
+
+char *
+strpool_add(struct strpool *p, const char *s, size_t len)
+{
+	struct strchunk *c = p->head;
+	size_t size;
+	char *str;
+
+	if (c == NULL || c->size - c->used < len + 1) {
+		size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+		c = malloc(sizeof(struct strchunk) + size);
+		if (c == NULL)
+			err(1, "Cannot allocate string chunk");
+		c->next = p->head;
+		c->used = 0;
+		c->size = size;
+		p->head = c;
+		p->bytes += sizeof(struct strchunk) + size;
+	}
+
+	str = &c->data[c->used];
+	memcpy(str, s, len);
+	str[len] = 0;
+	c->used += len + 1;
+
+	return str;
+}
+
+/* frees all strings but keeps the newest chunk for reuse */
+void
+strpool_reset(struct strpool *p)
+{
+	struct strchunk *c = p->head;
+
+	if (c == NULL)
+		return;
+
+	p->head = c->next;
+	strpool_free(p);
+	c->next = NULL;
+	c->used = 0;
+	p->head = c;
+	p->bytes = sizeof(struct strchunk) + c->size;
+}
+
+void
+strpool_free(struct strpool *p)
+{
+	struct strchunk *c;
+
+	while ((c = p->head) != NULL) {
+		p->head = c->next;
+		free(c);
+	}
+
+	p->bytes = 0;
+}
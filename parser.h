@@ -1,21 +1,44 @@
 #include <regex.h>
+#include <stddef.h>
+
+/*
+ * The scanners never write to the page text, so pages can be mapped
+ * read-only. A cell is returned as a span of the page, trimmed of
+ * leading space and of the markup and space ending it.
+ */
 
 struct trscanner
 {
-	char            *text;          // text to scan
+	const char      *text;          // text to scan
 	int             len;	        // maximum length
 	regex_t         p1;             // <td>
 	regex_t         p2;             // </td>
 	regmatch_t      m1;             // td start match
 	regmatch_t      m2;             // td end matches
-	char            *sbeg;          // td inner text start
-	char            *send;          // td inner text end
-	size_t          mlen;           // td inner text length
+	const char      *sbeg;          // td inner text start
+	const char      *send;          // td inner text end
+	size_t          mlen;           // trimmed inner text length
 };
 
-void trscanner_create(struct trscanner *s, char *text, int len);
+void trscanner_create(struct trscanner *s, const char *text, int len);
 void trscanner_destroy(struct trscanner *s);
 int trscanner_next(struct trscanner *s);
 
 void print_rex_error(int errcode, const regex_t *preg);
 
+/*
+ * String pool holding the NUL terminated copies of parsed fields. Strings
+ * never move, they are freed all at once.
+ */
+
+struct strchunk;
+
+struct strpool
+{
+	struct strchunk *head;          // newest chunk
+	size_t          bytes;          // allocated bytes
+};
+
+char *strpool_add(struct strpool *p, const char *s, size_t len);
+void strpool_reset(struct strpool *p);
+void strpool_free(struct strpool *p);
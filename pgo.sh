@@ -0,0 +1,34 @@
+#!/bin/bash
+# usage: pgo.sh srcdir builddir [cmake options]
+#
+# Builds departures with profile guided optimization and LTO: an
+# instrumented build is trained on the parser and lookup benchmark over
+# the captured pages in tests/, then builddir/bin/departures is built
+# with the collected profile. GCC names the profiles after the object
+# paths, so both builds run in builddir.
+
+set -e
+
+SRCDIR=$(cd $1; pwd)
+BDIR=$2
+shift 2
+
+PROFILES=$BDIR/profiles
+TRAIN="-B 20 $SRCDIR/tests/01 $SRCDIR/tests/02 $SRCDIR/tests/03"
+
+rm -rf $BDIR
+mkdir -p $BDIR $PROFILES
+
+cd $BDIR
+cmake -DCMAKE_BUILD_TYPE=Release -DLTO=ON -DPGO=generate -DPGO_DIR=$PROFILES "$@" $SRCDIR
+make departures
+./bin/departures $TRAIN
+
+# clang writes raw profiles that have to be merged
+if ls $PROFILES/*.profraw > /dev/null 2>&1 ; then
+	llvm-profdata merge -output=$PROFILES/default.profdata $PROFILES/*.profraw
+fi
+
+make clean
+cmake -DCMAKE_BUILD_TYPE=Release -DLTO=ON -DPGO=use -DPGO_DIR=$PROFILES "$@" $SRCDIR
+make departures
@@ -0,0 +1,360 @@
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stations.h"
+#include "board.h"
+#include "plan.h"
+#include "util.h"
+#include "log.h"
+
+#define PLAN_MAX_TRAINS         48      /* stop lists fetched for one query */
+#define PLAN_MAX_TRANSFERS      8       /* transfer stations whose boards are used */
+#define PLAN_BOARD_TRAINS       6       /* next trains taken from a board */
+#define PLAN_TRANSFER           5       /* minutes to change trains */
+#define PLAN_LOOKBACK           60      /* minutes before now covered by the clock */
+#define PLAN_NEVER              UINT16_MAX
+
+/* One hop of a train between two consecutive stops, times in minutes. */
+struct connection
+{
+	uint16_t        dep;            /* departure, minutes after the plan base */
+	uint16_t        arr;            /* arrival */
+	uint16_t        trip;           /* index into plan trains */
+	station_id      from;
+	station_id      to;
+};
+
+struct plan
+{
+	time_t          base;                           /* time of minute 0 */
+	struct connection *conns;                       /* connections */
+	size_t          n, cap;
+	char            trains[PLAN_MAX_TRAINS][8];     /* train numbers by trip */
+	size_t          n_trains;
+};
+
+/* walking transfers between stations of one complex */
+static const char *footpaths[][2] = {
+	{ "TS", "SE" },
+};
+
+static station_id
+footpath(station_id id)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(footpaths) / sizeof(footpaths[0]); i++) {
+		if (station_lookup(footpaths[i][0]) == id)
+			return station_lookup(footpaths[i][1]);
+		if (station_lookup(footpaths[i][1]) == id)
+			return station_lookup(footpaths[i][0]);
+	}
+
+	return STATION_NONE;
+}
+
+static int
+plan_clock(const struct plan *p, const char *s)
+{
+	time_t t = clock_time(s, p->base);
+
+	return t < 0 ? -1 : (t - p->base) / 60;
+}
+
+/*
+ * Stop status is "at 7:22" for scheduled stops or "in 5 Min" for the next
+ * ones, counted from loaded, when the stops page was parsed.
+ */
+static int
+stop_time(const struct plan *p, const char *status, time_t loaded)
+{
+	int min;
+
+	if (status == NULL)
+		return -1;
+
+	while (*status == ' ')
+		status++;
+
+	if (strncmp(status, "at ", 3) == 0)
+		return plan_clock(p, status + 3);
+
+	if (sscanf(status, "in %d Min", &min) == 1)
+		return (loaded - p->base) / 60 + min;
+
+	return -1;
+}
+
+static void
+plan_connect(struct plan *p, station_id from, station_id to, int dep, int arr, size_t trip)
+{
+	struct connection *c;
+
+	if (p->n == p->cap) {
+		p->cap = p->cap == 0 ? 256 : p->cap * 2;
+		p->conns = realloc(p->conns, p->cap * sizeof(struct connection));
+		if (p->conns == NULL)
+			err(1, "Cannot allocate connections");
+	}
+
+	c = &p->conns[p->n++];
+	c->dep = dep;
+	c->arr = arr;
+	c->trip = trip;
+	c->from = from;
+	c->to = to;
+}
+
+/* adds the connections of a train seen on the board of a station */
+static void
+plan_add_train(struct plan *p, station_id station, const char *train)
+{
+	struct train_stops *ts;
+	const struct stop *stop;
+	station_id prev = STATION_NONE;
+	int t, prev_t = -1;
+	size_t i;
+
+	for (i = 0; i < p->n_trains; i++) {
+		if (strcmp(p->trains[i], train) == 0)
+			return;
+	}
+
+	if (p->n_trains == PLAN_MAX_TRAINS || strlen(train) >= sizeof(p->trains[0]))
+		return;
+
+	ts = get_prev_stations(station, train);
+	if (ts == NULL)
+		return;
+
+	strcpy(p->trains[p->n_trains], train);
+
+	for (stop = ts->stops; stop < ts->stops + ts->n; stop++) {
+		t = stop_time(p, stop->status, ts->loaded);
+		if (stop->id == STATION_NONE || t < 0 || t >= PLAN_NEVER)
+			continue;
+
+		if (prev != STATION_NONE && t >= prev_t)
+			plan_connect(p, prev, stop->id, prev_t, t, p->n_trains);
+
+		prev = stop->id;
+		prev_t = t;
+	}
+
+	p->n_trains++;
+	train_stops_release(ts);
+}
+
+/* adds the next trains leaving the station after the given minute */
+static void
+plan_add_board(struct plan *p, station_id station, int after, struct board_deps *deps)
+{
+	struct station *st = board_get(station);
+	struct departure *dep;
+	size_t n = 0;
+	int t;
+
+	if (st == NULL) {
+		board_deps_missing(deps);
+		return;
+	}
+
+	board_deps_add(deps, st);
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		if (n == PLAN_BOARD_TRAINS)
+			break;
+
+		t = plan_clock(p, dep->time);
+		if (t < after)
+			continue;
+
+		plan_add_train(p, station, dep->train);
+		n++;
+	}
+
+	board_release(st);
+}
+
+static int
+compare_dep(const void *v1, const void *v2)
+{
+	const struct connection *c1 = v1;
+	const struct connection *c2 = v2;
+
+	if (c1->dep != c2->dep)
+		return (int)c1->dep - (int)c2->dep;
+
+	return (int)c1->arr - (int)c2->arr;
+}
+
+/*
+ * Connection scan. Boards at a station are possible PLAN_TRANSFER minutes
+ * after arriving there, or at once when staying on the same train.
+ */
+static int
+plan_scan(const struct plan *p, station_id from, station_id to, int start, struct trip *trip)
+{
+	uint16_t arrival[STATION_NONE], ready[STATION_NONE];
+	int32_t enter[STATION_NONE], leave[STATION_NONE];
+	station_id walked[STATION_NONE];
+	int32_t boarded[PLAN_MAX_TRAINS];
+	struct leg legs[PLAN_MAX_LEGS];
+	const struct connection *c;
+	station_id s, other;
+	size_t i, n = 0;
+
+	for (i = 0; i < STATION_NONE; i++) {
+		arrival[i] = ready[i] = PLAN_NEVER;
+		enter[i] = leave[i] = -1;
+		walked[i] = STATION_NONE;
+	}
+
+	for (i = 0; i < PLAN_MAX_TRAINS; i++)
+		boarded[i] = -1;
+
+	arrival[from] = ready[from] = start;
+	other = footpath(from);
+	if (other != STATION_NONE) {
+		arrival[other] = ready[other] = start + PLAN_TRANSFER;
+		walked[other] = from;
+	}
+
+	for (i = 0; i < p->n; i++) {
+		c = &p->conns[i];
+
+		if (c->dep >= arrival[to])
+			break;
+
+		if (boarded[c->trip] < 0) {
+			if (ready[c->from] > c->dep)
+				continue;
+			boarded[c->trip] = i;
+		}
+
+		if (c->arr >= arrival[c->to])
+			continue;
+
+		arrival[c->to] = c->arr;
+		ready[c->to] = c->arr + PLAN_TRANSFER;
+		enter[c->to] = boarded[c->trip];
+		leave[c->to] = i;
+		walked[c->to] = STATION_NONE;
+
+		other = footpath(c->to);
+		if (other != STATION_NONE && c->arr + PLAN_TRANSFER < arrival[other]) {
+			arrival[other] = ready[other] = c->arr + PLAN_TRANSFER;
+			walked[other] = c->to;
+		}
+	}
+
+	if (arrival[to] == PLAN_NEVER)
+		return -1;
+
+	/* legs are found from the destination back */
+	for (s = to; s != from; ) {
+		struct leg *l = &legs[n];
+
+		if (n == PLAN_MAX_LEGS)
+			return -1;
+
+		memset(l, 0, sizeof(struct leg));
+		l->to = s;
+		l->arrives = p->base + arrival[s] * 60;
+
+		if (walked[s] != STATION_NONE) {
+			l->from = walked[s];
+			l->departs = p->base + (arrival[s] - PLAN_TRANSFER) * 60;
+			s = walked[s];
+		} else {
+			c = &p->conns[enter[s]];
+			l->from = c->from;
+			l->departs = p->base + c->dep * 60;
+			l->arrives = p->base + p->conns[leave[s]].arr * 60;
+			strcpy(l->train, p->trains[c->trip]);
+			s = c->from;
+		}
+
+		n++;
+	}
+
+	trip->n = n;
+	for (i = 0; i < n; i++)
+		trip->legs[i] = legs[n - 1 - i];
+
+	return 0;
+}
+
+/*
+ * Finds the earliest arrival from one station to another leaving after now.
+ * Boards used are added to deps. Returns -1 if no trip was found.
+ */
+int
+plan_trip(station_id from, station_id to, time_t now, struct trip *trip, struct board_deps *deps)
+{
+	struct plan p;
+	station_id transfers[PLAN_MAX_TRANSFERS];
+	int after[PLAN_MAX_TRANSFERS];
+	uint16_t reached[STATION_NONE];
+	size_t i, j, n = 0, n_origin;
+	station_id s;
+	int rc, start;
+
+	memset(&p, 0, sizeof(struct plan));
+	p.base = now - now % 60 - PLAN_LOOKBACK * 60;
+	start = PLAN_LOOKBACK;
+
+	plan_add_board(&p, from, start, deps);
+	n_origin = p.n;
+
+	/* stations on the way that share a line with the destination */
+	for (i = 0; i < STATION_NONE; i++)
+		reached[i] = PLAN_NEVER;
+
+	for (i = 0; i < n_origin; i++) {
+		s = p.conns[i].to;
+		if (p.conns[i].arr < reached[s])
+			reached[s] = p.conns[i].arr;
+	}
+
+	/* a train from the origin gets there, no need to change */
+	for (i = 0; i < n_stations && n < PLAN_MAX_TRANSFERS && reached[to] == PLAN_NEVER; i++) {
+		if (reached[i] == PLAN_NEVER || i == from || i == to)
+			continue;
+
+		s = footpath(i);
+		if ((station_lines(i) & station_lines(to)) == 0)
+			s = s != STATION_NONE && (station_lines(s) & station_lines(to)) != 0 ? s : STATION_NONE;
+		else
+			s = i;
+
+		for (j = 0; j < n && s != STATION_NONE; j++) {
+			if (transfers[j] == s)
+				s = STATION_NONE;
+		}
+
+		if (s == STATION_NONE)
+			continue;
+
+		transfers[n] = s;
+		after[n] = reached[i] + PLAN_TRANSFER;
+		n++;
+	}
+
+	for (j = 0; j < n; j++)
+		plan_add_board(&p, transfers[j], after[j], deps);
+
+	log_add(LEVEL_DEBUG, "plan connections", station_code(from), p.n, station_code(to), strlen(station_code(to)));
+	log_num(LEVEL_DEBUG, "plan trains", station_code(from), p.n_trains);
+	log_num(LEVEL_DEBUG, "plan transfer stations", station_code(from), n);
+
+	qsort(p.conns, p.n, sizeof(struct connection), compare_dep);
+	rc = plan_scan(&p, from, to, start, trip);
+
+	free(p.conns);
+	return rc;
+}
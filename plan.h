@@ -0,0 +1,30 @@
+/*
+ * Trip planner for destinations without a direct train.
+ *
+ * A query gathers the trains leaving the origin and the trains leaving the
+ * stations they reach towards the destination, turns their stop lists into
+ * one array of elementary connections (station to next station) sorted by
+ * departure time, and scans it once (Connection Scan Algorithm) for the
+ * earliest arrival, allowing a transfer time at every change.
+ */
+
+#define PLAN_MAX_LEGS   8
+
+struct board_deps;
+
+struct leg
+{
+	char            train[8];       /* train number, empty for a walk */
+	station_id      from;           /* boarding station */
+	station_id      to;             /* alighting station */
+	time_t          departs;        /* departure from the boarding station */
+	time_t          arrives;        /* arrival at the alighting station */
+};
+
+struct trip
+{
+	size_t          n;                      /* number of legs */
+	struct leg      legs[PLAN_MAX_LEGS];    /* legs in travel order */
+};
+
+int plan_trip(station_id from, station_id to, time_t now, struct trip *trip, struct board_deps *deps);
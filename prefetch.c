@@ -0,0 +1,163 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "report.h"
+#include "render.h"
+#include "prefetch.h"
+#include "cluster.h"
+#include "log.h"
+
+#define PREFETCH_LEAD           45      /* seconds before the send, less than the page TTL */
+#define MAX_SUBSCRIPTIONS       64
+
+struct subscription
+{
+	int             hour;           /* send time */
+	int             min;
+	station_id      from;           /* origin station */
+	station_id      to;             /* destination station */
+};
+
+static size_t
+subscriptions_load(const char *fname, struct subscription *subs, size_t max)
+{
+	char line[256], from[64], to[64];
+	struct subscription *s;
+	size_t n = 0;
+	int lineno = 0;
+	FILE *f;
+
+	f = fopen(fname, "rt");
+	if (f == NULL)
+		return 0;
+
+	while (n < max && fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+			continue;
+
+		s = &subs[n];
+		if (sscanf(line, "%d:%d %63s %63s", &s->hour, &s->min, from, to) != 4 ||
+		    s->hour < 0 || s->hour > 23 || s->min < 0 || s->min > 59) {
+			warnx("%s:%d: expected HH:MM FROM TO", fname, lineno);
+			continue;
+		}
+
+		s->from = station_find(from);
+		s->to = station_find(to);
+		if (s->from == STATION_NONE || s->to == STATION_NONE) {
+			warnx("%s:%d: unknown station", fname, lineno);
+			continue;
+		}
+
+		n++;
+	}
+
+	fclose(f);
+	return n;
+}
+
+/* next time after now to warm the cache for the subscription */
+static time_t
+warm_time(const struct subscription *s, time_t now)
+{
+	struct tm tm;
+	time_t t;
+
+	localtime_r(&now, &tm);
+	tm.tm_hour = s->hour;
+	tm.tm_min = s->min;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+
+	t = mktime(&tm) - PREFETCH_LEAD;
+	if (t > now)
+		return t;
+
+	tm.tm_mday++;
+	tm.tm_isdst = -1;
+
+	return mktime(&tm) - PREFETCH_LEAD;
+}
+
+static void
+warm(const struct subscription *s)
+{
+	struct buf b;
+
+	/* in a cluster only the node owning the origin polls for it */
+	if (cluster_owner(station_code(s->from)) != NULL)
+		return;
+
+	log_add(LEVEL_INFO, "prefetch for hhmm", station_code(s->from), s->hour * 100 + s->min,
+		station_code(s->to), strlen(station_code(s->to)));
+
+	memset(&b, 0, sizeof(struct buf));
+	departures_render(&s->from, 1, s->to, FORMAT_TEXT, &b);
+	free(b.s);
+}
+
+/*
+ * Sleeps until the next warm time and warms every subscription due then.
+ * The schedule is read again on every round, so edits apply without a
+ * restart. Never returns unless the schedule is empty.
+ */
+int
+prefetch_run(const char *fname)
+{
+	struct subscription subs[MAX_SUBSCRIPTIONS];
+	time_t now, next, t;
+	size_t i, n;
+
+	for (;;) {
+		n = subscriptions_load(fname, subs, MAX_SUBSCRIPTIONS);
+		if (n == 0) {
+			warnx("No subscriptions in %s", fname);
+			return 1;
+		}
+
+		now = time(NULL);
+		next = 0;
+		for (i = 0; i < n; i++) {
+			t = warm_time(&subs[i], now);
+			if (next == 0 || t < next)
+				next = t;
+		}
+
+		while ((now = time(NULL)) < next)
+			sleep(next - now);
+
+		for (i = 0; i < n; i++) {
+			if (warm_time(&subs[i], next - 1) == next)
+				warm(&subs[i]);
+		}
+	}
+}
+
+static void *
+prefetch_loop(void *arg)
+{
+	prefetch_run(arg);
+	return NULL;
+}
+
+/* runs the planner on a thread next to the API server */
+void
+prefetch_start(const char *fname)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, prefetch_loop, (void *)fname) != 0)
+		errx(1, "Cannot create prefetch thread");
+
+	pthread_detach(thread);
+}
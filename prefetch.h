@@ -0,0 +1,13 @@
+/*
+ * Prefetch ahead of scheduled reports.
+ *
+ * The schedule file has one subscription per line, "HH:MM FROM TO", for
+ * reports sent at that local time. Shortly before each send the planner
+ * builds the report once, which fetches the origin board, the stop lists
+ * of the next trains and the boards of their upstream stops, so the run
+ * at send time finds every page in the cache. In a cluster each node warms
+ * only the subscriptions whose origin it owns.
+ */
+
+int prefetch_run(const char *fname);
+void prefetch_start(const char *fname);
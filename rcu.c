@@ -0,0 +1,102 @@
+#include "rcu.h"
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define RCU_MAX_THREADS 128
+
+struct retired
+{
+	void            *p;             /* retired object */
+	void            (*free_fn)(void *); /* destructor */
+	uint64_t        epoch;          /* epoch at retire time */
+	struct retired  *next;          /* next retired object */
+};
+
+static atomic_uint_fast64_t epoch = 1;                  /* global epoch */
+static atomic_uint_fast64_t readers[RCU_MAX_THREADS];   /* 0 or epoch at read lock */
+static atomic_int n_readers = 0;                        /* registered reader slots */
+static __thread int reader_slot = -1;                   /* slot of this thread */
+
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct retired *retired_list = NULL;
+
+static atomic_uint_fast64_t *
+reader()
+{
+	if (reader_slot < 0) {
+		reader_slot = atomic_fetch_add(&n_readers, 1);
+		if (reader_slot >= RCU_MAX_THREADS)
+			errx(1, "too many rcu reader threads");
+	}
+
+	return &readers[reader_slot];
+}
+
+void
+rcu_read_lock()
+{
+	atomic_store(reader(), atomic_load(&epoch));
+}
+
+void
+rcu_read_unlock()
+{
+	atomic_store_explicit(reader(), 0, memory_order_release);
+}
+
+void
+rcu_retire(void *p, void (*free_fn)(void *))
+{
+	struct retired *r = calloc(1, sizeof(struct retired));
+	if (r == NULL)
+		err(1, "Cannot allocate retired object");
+
+	r->p = p;
+	r->free_fn = free_fn;
+
+	pthread_mutex_lock(&retired_lock);
+	r->epoch = atomic_fetch_add(&epoch, 1);
+	r->next = retired_list;
+	retired_list = r;
+	pthread_mutex_unlock(&retired_lock);
+}
+
+void
+rcu_reclaim()
+{
+	uint64_t min = UINT64_MAX, e;
+	int i, n = atomic_load(&n_readers);
+	struct retired *r, **prev, *done = NULL;
+
+	if (n > RCU_MAX_THREADS)
+		n = RCU_MAX_THREADS;
+
+	for (i = 0; i < n; i++) {
+		e = atomic_load(&readers[i]);
+		if (e != 0 && e < min)
+			min = e;
+	}
+
+	pthread_mutex_lock(&retired_lock);
+	prev = &retired_list;
+	while ((r = *prev) != NULL) {
+		if (r->epoch < min) {
+			*prev = r->next;
+			r->next = done;
+			done = r;
+		} else {
+			prev = &r->next;
+		}
+	}
+	pthread_mutex_unlock(&retired_lock);
+
+	while (done != NULL) {
+		r = done;
+		done = r->next;
+		r->free_fn(r->p);
+		free(r);
+	}
+}
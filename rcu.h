@@ -0,0 +1,14 @@
+/*
+ * Epoch based read-copy-update for immutable snapshots.
+ *
+ * Readers bracket pointer loads with rcu_read_lock()/rcu_read_unlock(),
+ * which only store the current epoch into a per-thread slot. Writers swap
+ * the published pointer atomically and hand the old object to
+ * rcu_retire(); rcu_reclaim() frees it once every reader that could have
+ * seen it has left its read-side section. Read sections must not nest.
+ */
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void rcu_retire(void *p, void (*free_fn)(void *));
+void rcu_reclaim(void);
@@ -0,0 +1,191 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "report.h"
+#include "render.h"
+#include "mem.h"
+#include "trace.h"
+#include "log.h"
+
+#define RENDER_BUCKETS  256
+#define RENDER_MAX      1024
+
+struct rendered
+{
+	uint64_t                key;            /* origins, to and format */
+	int                     rc;             /* report result */
+	char                    *text;          /* rendered output */
+	size_t                  len;            /* output length */
+	struct board_deps       deps;           /* boards it was built from */
+	atomic_bool             referenced;     /* used since the last eviction sweep */
+	struct rendered         *next;          /* next in bucket */
+};
+
+static struct rendered *buckets[RENDER_BUCKETS];
+static size_t n_rendered = 0;
+static unsigned clock_hand = 0;         /* next bucket to sweep */
+static pthread_rwlock_t render_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static unsigned
+hash(uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ull) >> 56;
+}
+
+/* packs up to MAX_ORIGINS origins, unused ones STATION_NONE, with to and format */
+static uint64_t
+render_key(const station_id *from, size_t n_from, station_id to, enum report_format format)
+{
+	uint64_t key = 0;
+	size_t i;
+
+	for (i = 0; i < MAX_ORIGINS; i++)
+		key = key << 8 | (i < n_from ? from[i] : STATION_NONE);
+
+	return key << 16 | (uint64_t)to << 8 | format;
+}
+
+static void
+render_store(uint64_t key, unsigned h, int rc, const char *text, const struct board_deps *deps)
+{
+	struct rendered *r, **prev;
+
+	pthread_rwlock_wrlock(&render_lock);
+
+	for (prev = &buckets[h]; (r = *prev) != NULL; prev = &r->next) {
+		if (r->key == key)
+			break;
+	}
+
+	if (r == NULL) {
+		if (n_rendered >= RENDER_MAX) {
+			pthread_rwlock_unlock(&render_lock);
+			return;
+		}
+
+		r = calloc(1, sizeof(struct rendered));
+		if (r == NULL)
+			err(1, "Cannot allocate rendered output");
+
+		r->key = key;
+		r->next = buckets[h];
+		buckets[h] = r;
+		n_rendered++;
+	} else {
+		mem_uncharge(MEM_RENDERED, sizeof(struct rendered) + r->len + 1);
+	}
+
+	free(r->text);
+	r->len = strlen(text);
+	r->text = strdup(text);
+	r->rc = rc;
+	r->deps = *deps;
+	atomic_store(&r->referenced, true);
+	mem_charge(MEM_RENDERED, sizeof(struct rendered) + r->len + 1);
+
+	pthread_rwlock_unlock(&render_lock);
+
+	mem_reclaim();
+}
+
+/*
+ * Frees one rendered report that was not used since the clock hand last
+ * passed it. Returns its bytes, 0 if nothing is cached.
+ */
+size_t
+render_evict()
+{
+	struct rendered *r, **prev;
+	size_t i, bytes = 0;
+
+	pthread_rwlock_wrlock(&render_lock);
+
+	for (i = 0; i < 2 * RENDER_BUCKETS && n_rendered > 0 && bytes == 0; i++) {
+		for (prev = &buckets[clock_hand]; (r = *prev) != NULL; ) {
+			if (atomic_exchange(&r->referenced, false)) {
+				prev = &r->next;
+				continue;
+			}
+
+			*prev = r->next;
+			bytes = sizeof(struct rendered) + r->len + 1;
+			mem_uncharge(MEM_RENDERED, bytes);
+			n_rendered--;
+			free(r->text);
+			free(r);
+			break;
+		}
+
+		if (bytes == 0)
+			clock_hand = (clock_hand + 1) % RENDER_BUCKETS;
+	}
+
+	pthread_rwlock_unlock(&render_lock);
+
+	return bytes;
+}
+
+/*
+ * Appends the report from the origins to to in the format to b, rendering
+ * it only if no cached output is built from the current boards.
+ */
+int
+departures_render(const station_id *from, size_t n_from, station_id to,
+		  enum report_format format, struct buf *b)
+{
+	uint64_t key = render_key(from, n_from, to, format);
+	struct rendered *r;
+	struct board_deps deps;
+	struct buf out;
+	struct trace_span span;
+	size_t len = 0;
+	unsigned h;
+	int rc;
+
+	h = hash(key);
+	trace_begin(&span, "render", "departures_render");
+
+	pthread_rwlock_rdlock(&render_lock);
+	for (r = buckets[h]; r != NULL; r = r->next) {
+		if (r->key == key && board_deps_current(&r->deps)) {
+			buf_append(b, r->text, r->len);
+			if (!atomic_load_explicit(&r->referenced, memory_order_relaxed))
+				atomic_store(&r->referenced, true);
+			rc = r->rc;
+			len = r->len;
+			pthread_rwlock_unlock(&render_lock);
+			log_add(LEVEL_DEBUG, "render cache hit", station_code(from[0]), format,
+				station_code(to), to != STATION_NONE ? strlen(station_code(to)) : 0);
+			trace_mark("cache", "render hit", station_code(from[0]));
+			trace_end(&span, station_code(from[0]), len);
+			return rc;
+		}
+	}
+	pthread_rwlock_unlock(&render_lock);
+
+	trace_mark("cache", "render miss", station_code(from[0]));
+	memset(&deps, 0, sizeof(struct board_deps));
+	memset(&out, 0, sizeof(struct buf));
+
+	rc = departures_get_upcoming(from, n_from, to, format, &out, &deps);
+
+	if (out.s != NULL) {
+		render_store(key, h, rc, out.s, &deps);
+		len = strlen(out.s);
+		buf_append(b, out.s, len);
+		free(out.s);
+	}
+
+	trace_end(&span, station_code(from[0]), len);
+
+	return rc;
+}
@@ -0,0 +1,11 @@
+/*
+ * Rendered report cache. Outputs are keyed by (origins, to, format) and tagged
+ * with the versions of the boards they were built from; an entry is reused
+ * until one of those boards is refreshed or expires.
+ */
+
+struct buf;
+
+int departures_render(const station_id *from, size_t n_from, station_id to,
+		      enum report_format format, struct buf *b);
+size_t render_evict(void);
@@ -0,0 +1,921 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
+#include "json.h"
+#include "report.h"
+#include "plan.h"
+#include "util.h"
+
+#define MAX_NEXT_TRAINS 3
+#define BOARD_LOOKBACK  3600    /* seconds a late train may stay on a board */
+
+/*
+ * Report output. Text and JSON are written straight into the buffer while
+ * the report walks the boards, so neither format builds the report first.
+ */
+struct report_out
+{
+	enum report_format      format;         /* output format */
+	struct buf              *b;             /* output buffer */
+	struct json             j;              /* JSON writer state */
+};
+
+static void
+out_init(struct report_out *o, enum report_format format, struct buf *b)
+{
+	o->format = format;
+	o->b = b;
+	json_init(&o->j, b);
+}
+
+/*
+ * Minutes the train leaves after its timetable time, INT_MIN if unknown.
+ * The "in N Min" status counts from loaded, when the board was parsed.
+ */
+static int
+departure_delay(const struct departure *dep, time_t loaded)
+{
+	int in;
+
+	if (dep->scheduled == 0 || dep->status == NULL)
+		return INT_MIN;
+
+	if (sscanf(dep->status, "in %d Min", &in) != 1)
+		return INT_MIN;
+
+	return loaded / 60 + in - dep->scheduled / 60;
+}
+
+/* adds the timetable departure and the delay of a train with a schedule */
+static void
+schedule_json(struct json *j, const struct departure *dep, time_t loaded)
+{
+	struct tm tm;
+	char s[8];
+	int delay;
+
+	if (dep->scheduled == 0)
+		return;
+
+	localtime_r(&dep->scheduled, &tm);
+	snprintf(s, sizeof(s), "%d:%02d", tm.tm_hour % 12 != 0 ? tm.tm_hour % 12 : 12, tm.tm_min);
+
+	json_key(j, "scheduled");
+	json_string(j, s);
+	json_key(j, "delay");
+	delay = departure_delay(dep, loaded);
+	if (delay != INT_MIN)
+		json_int(j, delay);
+	else
+		json_null(j);
+}
+
+static void
+out_station(struct json *j, const char *key, station_id id)
+{
+	json_key(j, key);
+	json_begin_object(j);
+	json_key(j, "code");
+	json_string(j, station_code(id));
+	json_key(j, "name");
+	json_string(j, station_name(id));
+	json_end_object(j);
+}
+
+static void
+out_error(struct report_out *o, const char *msg, station_id id)
+{
+	if (o->format == FORMAT_JSON) {
+		json_begin_object(&o->j);
+		json_key(&o->j, "error");
+		json_string(&o->j, msg);
+		if (id != STATION_NONE)
+			out_station(&o->j, "station", id);
+		json_end_object(&o->j);
+		return;
+	}
+
+	if (id != STATION_NONE)
+		buf_appendf(o->b, "%s %s(%s)\n", msg, station_name(id), station_code(id));
+	else
+		buf_appendf(o->b, "%s\n", msg);
+}
+
+static void
+out_destinations(struct report_out *o, const station_id *ids, size_t sz)
+{
+	size_t i;
+
+	if (o->format == FORMAT_JSON) {
+		json_begin_object(&o->j);
+		json_key(&o->j, "error");
+		json_string(&o->j, "Multiple destinations found");
+		json_key(&o->j, "destinations");
+		json_begin_array(&o->j);
+	} else {
+		buf_appendf(o->b, "Multiple destinantions found.\nUse -t parameter and station code from the list:\n");
+	}
+
+	for (i = 0; i < sz; i++) {
+		if (o->format == FORMAT_JSON) {
+			json_begin_object(&o->j);
+			json_key(&o->j, "code");
+			json_string(&o->j, station_code(ids[i]));
+			json_key(&o->j, "name");
+			json_string(&o->j, station_name(ids[i]));
+			json_end_object(&o->j);
+		} else {
+			buf_appendf(o->b, "%-20s %s\n", station_name(ids[i]), station_code(ids[i]));
+		}
+	}
+
+	if (o->format == FORMAT_JSON) {
+		json_end_array(&o->j);
+		json_end_object(&o->j);
+	}
+}
+
+/* a report from several origins has an array of them and the origin of every train */
+static void
+out_begin(struct report_out *o, const station_id *from, size_t n_from, station_id to)
+{
+	size_t i;
+
+	if (o->format == FORMAT_JSON) {
+		json_begin_object(&o->j);
+		if (n_from > 1) {
+			json_key(&o->j, "from");
+			json_begin_array(&o->j);
+			for (i = 0; i < n_from; i++) {
+				json_begin_object(&o->j);
+				json_key(&o->j, "code");
+				json_string(&o->j, station_code(from[i]));
+				json_key(&o->j, "name");
+				json_string(&o->j, station_name(from[i]));
+				json_end_object(&o->j);
+			}
+			json_end_array(&o->j);
+		} else {
+			out_station(&o->j, "from", from[0]);
+		}
+		out_station(&o->j, "to", to);
+		json_key(&o->j, "trains");
+		json_begin_array(&o->j);
+		return;
+	}
+
+	buf_appendf(o->b, "\nTrains from %s", station_name(from[0]));
+	for (i = 1; i < n_from; i++)
+		buf_appendf(o->b, " or %s", station_name(from[i]));
+	buf_appendf(o->b, " to %s:\n\n", station_name(to));
+}
+
+/* from is the origin of the train, STATION_NONE for a single origin report */
+static void
+out_train(struct report_out *o, const struct departure *dep, station_id from, time_t loaded)
+{
+	if (o->format == FORMAT_JSON) {
+		json_begin_object(&o->j);
+		if (from != STATION_NONE)
+			out_station(&o->j, "from", from);
+		json_key(&o->j, "time");
+		json_string(&o->j, dep->time);
+		json_key(&o->j, "train");
+		json_string(&o->j, dep->train);
+		json_key(&o->j, "track");
+		json_string(&o->j, dep->track);
+		json_key(&o->j, "line");
+		json_string(&o->j, dep->line);
+		json_key(&o->j, "status");
+		json_string(&o->j, dep->status);
+		schedule_json(&o->j, dep, loaded);
+		return;
+	}
+
+	buf_appendf(o->b, "%s #%s", dep->time, dep->train);
+	if (from != STATION_NONE)
+		buf_appendf(o->b, " from %s(%s)", station_name(from), station_code(from));
+	buf_appendf(o->b, ", Track %s", dep->track);
+
+	if (dep->status != NULL && strlen(dep->status) > 0) {
+		buf_append(o->b, " ", 1);
+		buf_append(o->b, dep->status, strlen(dep->status));
+	}
+
+	int delay = departure_delay(dep, loaded);
+	if (delay > 0)
+		buf_appendf(o->b, " (late %d min)", delay);
+	else if (delay != INT_MIN)
+		buf_appendf(o->b, " (on time)");
+
+	buf_append(o->b, ".", 1);
+}
+
+static void
+out_no_route(struct report_out *o, const struct departure *dep, station_id from, station_id to)
+{
+	if (o->format == FORMAT_JSON) {
+		json_key(&o->j, "stops");
+		json_null(&o->j);
+		json_end_object(&o->j);
+		return;
+	}
+
+	buf_appendf(o->b, "No route found for train %s from %s to %s\n", dep->train,
+		    station_code(from), station_code(to));
+}
+
+static void
+out_stop(struct report_out *o, station_id id, const char *status, bool first)
+{
+	const char *positive = " Previous stops status:\n\n";
+
+	if (o->format == FORMAT_JSON) {
+		if (first) {
+			json_key(&o->j, "stops");
+			json_begin_array(&o->j);
+		}
+		json_begin_object(&o->j);
+		json_key(&o->j, "code");
+		json_string(&o->j, station_code(id));
+		json_key(&o->j, "name");
+		json_string(&o->j, station_name(id));
+		json_key(&o->j, "status");
+		json_string(&o->j, status);
+		json_end_object(&o->j);
+		return;
+	}
+
+	if (first)
+		buf_append(o->b, positive, strlen(positive));
+
+	buf_appendf(o->b, "    %s(%s): %s\n", station_name(id), station_code(id), status);
+}
+
+static void
+out_train_end(struct report_out *o, bool appended)
+{
+	const char *negative = " No previous stops status.\n";
+
+	if (o->format == FORMAT_JSON) {
+		if (!appended) {
+			json_key(&o->j, "stops");
+			json_begin_array(&o->j);
+		}
+		json_end_array(&o->j);
+		json_end_object(&o->j);
+		return;
+	}
+
+	if (!appended)
+		buf_append(o->b, negative, strlen(negative));
+
+	buf_append(o->b, "\n", 1);
+}
+
+static void
+out_clock(char *s, size_t sz, time_t t)
+{
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	snprintf(s, sz, "%d:%02d", tm.tm_hour % 12 == 0 ? 12 : tm.tm_hour % 12, tm.tm_min);
+}
+
+/* the legs array is closed by out_end() */
+static void
+out_trip(struct report_out *o, station_id from, station_id to, const struct trip *trip)
+{
+	const struct leg *l;
+	char dep[8], arr[8];
+	size_t i;
+
+	if (o->format == FORMAT_JSON) {
+		json_begin_object(&o->j);
+		out_station(&o->j, "from", from);
+		out_station(&o->j, "to", to);
+		json_key(&o->j, "legs");
+		json_begin_array(&o->j);
+	} else {
+		buf_appendf(o->b, "\nTrip from %s to %s:\n\n", station_name(from), station_name(to));
+	}
+
+	for (i = 0; i < trip->n; i++) {
+		l = &trip->legs[i];
+		out_clock(dep, sizeof(dep), l->departs);
+		out_clock(arr, sizeof(arr), l->arrives);
+
+		if (o->format == FORMAT_JSON) {
+			json_begin_object(&o->j);
+			json_key(&o->j, "train");
+			json_string(&o->j, l->train[0] != 0 ? l->train : NULL);
+			out_station(&o->j, "from", l->from);
+			out_station(&o->j, "to", l->to);
+			json_key(&o->j, "departs");
+			json_string(&o->j, dep);
+			json_key(&o->j, "arrives");
+			json_string(&o->j, arr);
+			json_end_object(&o->j);
+		} else if (l->train[0] == 0) {
+			buf_appendf(o->b, "%s walk from %s(%s) to %s(%s), arrives %s\n", dep,
+				    station_name(l->from), station_code(l->from),
+				    station_name(l->to), station_code(l->to), arr);
+		} else {
+			buf_appendf(o->b, "%s #%s from %s(%s) to %s(%s), arrives %s\n", dep, l->train,
+				    station_name(l->from), station_code(l->from),
+				    station_name(l->to), station_code(l->to), arr);
+		}
+	}
+}
+
+static void
+out_end(struct report_out *o)
+{
+	if (o->format == FORMAT_JSON) {
+		json_end_array(&o->j);
+		json_key(&o->j, "credits");
+		json_string(&o->j, "Data provided by NJ TRANSIT, which is the sole owner of the Data.");
+		json_end_object(&o->j);
+		return;
+	}
+
+	buf_append(o->b, credits, sz_credits - 1);
+}
+
+int
+report_format_parse(const char *s, enum report_format *format)
+{
+	if (strcmp(s, "text") == 0)
+		*format = FORMAT_TEXT;
+	else if (strcmp(s, "json") == 0)
+		*format = FORMAT_JSON;
+	else
+		return -1;
+
+	return 0;
+}
+
+/* a next train to the destination and the origin it leaves from */
+struct next_train
+{
+	struct departure        *dep;           /* board row */
+	station_id              from;           /* origin */
+	time_t                  t;              /* departure time */
+	time_t                  loaded;         /* time the board was parsed */
+};
+
+/* next train to the destination on a board at or after dep */
+static struct departure *
+next_to(struct departure *dep, station_id to)
+{
+	while (dep != NULL && dep->dest != to)
+		dep = SLIST_NEXT(dep, entries);
+
+	return dep;
+}
+
+static void
+heap_down(struct next_train *h, size_t n, size_t i)
+{
+	struct next_train tmp;
+	size_t c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && h[c + 1].t < h[c].t)
+			c++;
+		if (h[i].t <= h[c].t)
+			break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+		i = c;
+	}
+}
+
+/*
+ * Collects up to max next trains to the destination from the boards of
+ * the origins into next[] in departure order. Every board is in time
+ * order, so the boards are merged through a heap of their next trains
+ * to the destination. A train stopping at several origins is taken at
+ * the first one. Boards are shared snapshots, so the order is kept
+ * outside of the departures. Returns the number of next trains.
+ */
+static size_t
+departures_merge_next(struct station *const *st, size_t n, station_id to,
+		      struct next_train *next, size_t max)
+{
+	struct next_train heap[MAX_ORIGINS];
+	time_t base = clock_now() - BOARD_LOOKBACK;
+	size_t h = 0, num = 0, i;
+	struct departure *dep;
+
+	for (i = 0; i < n; i++) {
+		if (st[i] == NULL || (dep = next_to(SLIST_FIRST(st[i]->deps->list), to)) == NULL)
+			continue;
+		heap[h].dep = dep;
+		heap[h].from = st[i]->id;
+		heap[h].loaded = st[i]->loaded;
+		heap[h].t = clock_time(dep->time, base);
+		h++;
+	}
+
+	for (i = h / 2; i-- > 0; )
+		heap_down(heap, h, i);
+
+	while (h > 0 && num < max) {
+		dep = heap[0].dep;
+
+		for (i = 0; i < num; i++)
+			if (strcmp(next[i].dep->train, dep->train) == 0)
+				break;
+		if (i == num)
+			next[num++] = heap[0];
+
+		dep = next_to(SLIST_NEXT(dep, entries), to);
+		if (dep != NULL) {
+			heap[0].dep = dep;
+			heap[0].t = clock_time(dep->time, base);
+		} else {
+			heap[0] = heap[--h];
+		}
+		heap_down(heap, h, 0);
+	}
+
+	return num;
+}
+
+static bool
+train_append_status(struct report_out *o, struct station *st, const char *train, bool appended)
+{
+	struct departure *dep;
+	const char *status = NULL;
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+
+		if (strcmp(train, dep->train) != 0)
+			continue;
+
+		status = dep->status;
+		if (status != NULL && *status != 0) {
+			out_stop(o, st->id, status, !appended);
+			appended = true;
+		}
+	}
+
+	return appended;
+}
+
+static int
+compare(const void *v1, const void *v2)
+{
+	station_id id1 = *(const station_id *)v1;
+	station_id id2 = *(const station_id *)v2;
+	return strcmp(station_code(id1), station_code(id2));
+}
+
+/*
+ * Returns the destination if it is known or the boards have only one,
+ * otherwise lists the boards' destinations ordered by code.
+ */
+static station_id
+propose_destinations(struct station *const *st, size_t n, station_id to, struct report_out *o)
+{
+	station_id ids[STATION_NONE];
+	bool seen[STATION_NONE] = { false };
+	size_t sz = 0, i;
+	struct departure* dep;
+
+	if (to != STATION_NONE)
+		return to;
+
+	for (i = 0; i < n; i++) {
+		if (st[i] == NULL)
+			continue;
+		SLIST_FOREACH(dep, st[i]->deps->list, entries) {
+			if (dep->dest != STATION_NONE && !seen[dep->dest]) {
+				seen[dep->dest] = true;
+				ids[sz++] = dep->dest;
+			}
+		}
+	}
+
+	if (sz == 1)
+		return ids[0];
+
+	qsort(ids, sz, sizeof(ids[0]), compare);
+	out_destinations(o, ids, sz);
+
+	return STATION_NONE;
+}
+
+static void
+train_append_prev_stops(struct report_out *o, station_id from, station_id to,
+			const struct departure *dep, struct board_deps *deps)
+{
+	struct train_stops *ts = get_prev_stations(from, dep->train);
+
+	if (ts == NULL || ts->n == 0) {
+		if (ts == NULL)
+			board_deps_missing(deps);
+		out_no_route(o, dep, from, to);
+		train_stops_release(ts);
+		return;
+	}
+
+	/* previous stops, nearest first */
+	const struct stop *origin_stop = train_stop(ts, from);
+	size_t i = origin_stop != NULL ? (size_t)(origin_stop - ts->stops) : 0;
+
+	bool appended = false;
+
+	while (i-- > 0) {
+
+		struct station *st = board_get(ts->stops[i].id);
+
+		if (st != NULL) {
+			if (debug)
+				station_dump(st);
+
+			board_deps_add(deps, st);
+			appended |= train_append_status(o, st, dep->train, appended);
+			board_release(st);
+		} else {
+			/* the report goes out without this stop */
+			board_deps_missing(deps);
+		}
+	}
+
+	out_train_end(o, appended);
+	train_stops_release(ts);
+}
+
+static void
+boards_release(struct station **st, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		board_release(st[i]);
+}
+
+/* plans a trip from every origin and keeps the one arriving first */
+static int
+plan_first_trip(const station_id *from, size_t n_from, station_id to, struct trip *trip,
+		station_id *origin, struct board_deps *deps)
+{
+	struct trip t;
+	size_t i;
+	int rc = -1;
+
+	for (i = 0; i < n_from; i++) {
+		if (plan_trip(from[i], to, clock_now(), &t, deps) != 0)
+			continue;
+		if (rc == 0 && t.legs[t.n - 1].arrives >= trip->legs[trip->n - 1].arrives)
+			continue;
+		*trip = t;
+		*origin = from[i];
+		rc = 0;
+	}
+
+	return rc;
+}
+
+/*
+ * Writes the next trains from any of the origins to the destination in
+ * departure order. Origins whose board can't be fetched are left out of
+ * the report, the report fails if no board is left.
+ */
+int
+departures_get_upcoming(const station_id *from, size_t n_from, station_id to,
+			enum report_format format, struct buf *b, struct board_deps *deps)
+{
+	struct report_out o;
+	struct station *st[MAX_ORIGINS];
+	size_t i, n_boards = 0;
+
+	out_init(&o, format, b);
+
+	for (i = 0; i < n_from; i++) {
+		st[i] = board_get(from[i]);
+		if (st[i] == NULL) {
+			board_deps_missing(deps);
+			continue;
+		}
+
+		n_boards++;
+		board_deps_add(deps, st[i]);
+
+		if (debug)
+			station_dump(st[i]);
+	}
+
+	if (n_boards == 0) {
+		out_error(&o, "Cannot get departures for station code", from[0]);
+		return 1;
+	}
+
+	to = propose_destinations(st, n_from, to, &o);
+
+	if (to == STATION_NONE) {
+		boards_release(st, n_from);
+		return 1;
+	}
+
+	struct next_train next[MAX_NEXT_TRAINS];
+	size_t n_next_trains = departures_merge_next(st, n_from, to, next, MAX_NEXT_TRAINS);
+	if (n_next_trains == 0) {
+		struct trip trip;
+		station_id origin = from[0];
+
+		boards_release(st, n_from);
+
+		if (plan_first_trip(from, n_from, to, &trip, &origin, deps) != 0) {
+			out_error(&o, "No next trains found to", to);
+			return 1;
+		}
+
+		out_trip(&o, origin, to, &trip);
+		out_end(&o);
+		return 0;
+	}
+
+	if (debug)
+		printf("number of next trains to %s: %zu\n", station_code(to), n_next_trains);
+
+	if (debug)
+		printf("previous stations list:\n");
+
+	out_begin(&o, from, n_from, to);
+
+	for (i = 0; i < n_next_trains; i++) {
+		struct departure *dep = next[i].dep;
+
+		if (debug)
+			printf("get status for next train %s to %s, idx: %zu\n", dep->train, station_code(to), i + 1);
+
+		out_train(&o, dep, n_from > 1 ? next[i].from : STATION_NONE, next[i].loaded);
+		train_append_prev_stops(&o, next[i].from, to, dep, deps);
+	}
+
+	out_end(&o);
+	boards_release(st, n_from);
+
+	return 0;
+}
+
+/* writes msg about station id, "Name(XX)" in text or an error object in JSON */
+void
+report_error(const char *msg, station_id id, enum report_format format, struct buf *b)
+{
+	struct report_out o;
+
+	out_init(&o, format, b);
+	out_error(&o, msg, id);
+}
+
+void
+departure_json(struct json *j, const struct departure *dep, time_t loaded)
+{
+	json_begin_object(j);
+	json_key(j, "time");
+	json_string(j, dep->time);
+	json_key(j, "train");
+	json_string(j, dep->train);
+	json_key(j, "to");
+	json_string(j, station_code(dep->dest));
+	json_key(j, "destination");
+	json_string(j, dep->destination);
+	json_key(j, "track");
+	json_string(j, dep->track);
+	json_key(j, "line");
+	json_string(j, dep->line);
+	json_key(j, "status");
+	json_string(j, dep->status);
+	schedule_json(j, dep, loaded);
+	json_end_object(j);
+}
+
+/* board output shared by board_render() and report_stream() */
+struct board_out
+{
+	enum report_format      format;         /* output format */
+	const struct board_filter *filter;      /* rows to show, NULL for all */
+	struct buf              *b;             /* output buffer */
+	struct json             j;              /* JSON writer state */
+	FILE                    *f;             /* flush the buffer here after every row */
+	time_t                  loaded;         /* time the board was parsed */
+	size_t                  seen;           /* rows that passed the window */
+	size_t                  shown;          /* rows written */
+};
+
+/* returns -1 to skip the row, 0 to show it, 1 if no later row can be shown */
+static int
+board_filter_row(struct board_out *o, const struct departure *dep)
+{
+	const struct board_filter *f = o->filter;
+	time_t t;
+
+	if (f == NULL)
+		return 0;
+
+	if (f->window > 0) {
+		t = clock_time(dep->time, f->now - BOARD_LOOKBACK);
+		/* boards are in time order */
+		if (t > f->now + f->window * 60)
+			return 1;
+	}
+
+	if (f->limit > 0 && o->shown == f->limit)
+		return 1;
+
+	if (o->seen++ < f->offset)
+		return -1;
+
+	return 0;
+}
+
+static void
+board_flush(struct board_out *o)
+{
+	if (o->f == NULL || o->b->s == NULL)
+		return;
+
+	fputs(o->b->s, o->f);
+	free(o->b->s);
+	memset(o->b, 0, sizeof(struct buf));
+}
+
+static void
+board_begin(struct board_out *o, station_id id)
+{
+	o->seen = 0;
+	o->shown = 0;
+
+	if (o->format == FORMAT_TEXT) {
+		buf_appendf(o->b, "%s(%s)\n", station_name(id), station_code(id));
+		return;
+	}
+
+	json_begin_object(&o->j);
+	out_station(&o->j, "station", id);
+	json_key(&o->j, "departures");
+	json_begin_array(&o->j);
+}
+
+/* returns nonzero if no later row can be shown */
+static int
+board_row(struct board_out *o, const struct departure *dep)
+{
+	const char *code = station_code(dep->dest);
+	int rc = board_filter_row(o, dep);
+
+	if (rc != 0)
+		return rc > 0;
+
+	o->shown++;
+
+	if (o->format == FORMAT_TEXT) {
+		buf_appendf(o->b, "%7s %5s %-2s %-20s %3s %s\n",
+			dep->time, dep->train, code != NULL ? code : "",
+			dep->destination, dep->track, dep->status ? dep->status : "");
+	} else {
+		departure_json(&o->j, dep, o->loaded);
+	}
+
+	board_flush(o);
+	return 0;
+}
+
+static void
+board_end(struct board_out *o)
+{
+	if (o->format == FORMAT_JSON) {
+		json_end_array(&o->j);
+		json_end_object(&o->j);
+	}
+
+	board_flush(o);
+}
+
+void
+board_render(struct station *st, enum report_format format, const struct board_filter *filter, struct buf *b)
+{
+	struct departure *dep;
+	struct board_out o;
+
+	memset(&o, 0, sizeof(struct board_out));
+	o.format = format;
+	o.filter = filter;
+	o.b = b;
+	o.loaded = st->loaded;
+	json_init(&o.j, b);
+
+	board_begin(&o, st->id);
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		if (board_row(&o, dep) != 0)
+			break;
+	}
+
+	board_end(&o);
+}
+
+static int
+stream_row(void *arg, struct departure *dep)
+{
+	struct board_out *o = arg;
+
+	return board_row(o, dep);
+}
+
+/*
+ * Appends the board of the station to b row by row while its page is
+ * parsed, like board_render() without building the board. Returns -1 if
+ * the page can't be fetched, b then has only the board header.
+ */
+int
+board_stream(station_id id, enum report_format format, const struct board_filter *filter, struct buf *b)
+{
+	struct board_out o;
+
+	memset(&o, 0, sizeof(struct board_out));
+	o.format = format;
+	o.filter = filter;
+	o.b = b;
+	json_init(&o.j, b);
+
+	board_begin(&o, id);
+
+	o.loaded = clock_now();
+	if (station_stream(id, stream_row, &o) != 0)
+		return -1;
+
+	board_end(&o);
+
+	return 0;
+}
+
+/*
+ * Writes the boards of the stations to f row by row while their pages are
+ * parsed, so no board is built in memory. Returns 1 if a board could not
+ * be fetched.
+ */
+int
+report_stream(const station_id *ids, size_t n, enum report_format format,
+	      const struct board_filter *filter, FILE *f)
+{
+	struct board_out o;
+	struct buf b;
+	size_t i;
+	int rc = 0;
+
+	memset(&b, 0, sizeof(struct buf));
+	memset(&o, 0, sizeof(struct board_out));
+	o.format = format;
+	o.filter = filter;
+	o.b = &b;
+	o.f = f;
+	json_init(&o.j, &b);
+
+	if (format == FORMAT_JSON && n > 1)
+		json_begin_array(&o.j);
+
+	for (i = 0; i < n; i++) {
+		if (format == FORMAT_TEXT && i > 0)
+			buf_append(&b, "\n", 1);
+
+		board_begin(&o, ids[i]);
+
+		o.loaded = clock_now();
+		if (station_stream(ids[i], stream_row, &o) != 0) {
+			rc = 1;
+			if (format == FORMAT_JSON) {
+				json_end_array(&o.j);
+				/* the board object already names the station */
+				json_key(&o.j, "error");
+				json_string(&o.j, "Cannot get departures for");
+				json_end_object(&o.j);
+				continue;
+			}
+			report_error("Cannot get departures for", ids[i], format, &b);
+		}
+
+		board_end(&o);
+	}
+
+	if (format == FORMAT_JSON && n > 1)
+		json_end_array(&o.j);
+	if (format == FORMAT_JSON)
+		buf_append(&b, "\n", 1);
+
+	board_flush(&o);
+
+	return rc;
+}
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_ORIGINS     4       /* origins merged into one report */
+
+struct buf;
+struct board_deps;
+struct station;
+struct departure;
+struct json;
+
+/* Board rows to show: a time window from now, then a page of it. */
+struct board_filter
+{
+	size_t          offset;         /* rows to skip */
+	size_t          limit;          /* rows to show, 0 for all */
+	int             window;         /* minutes ahead of now, 0 for the whole board */
+	time_t          now;            /* start of the window */
+};
+
+enum report_format
+{
+	FORMAT_TEXT,                    /* plain text report */
+	FORMAT_JSON,                    /* JSON document */
+};
+
+int report_format_parse(const char *s, enum report_format *format);
+int departures_get_upcoming(const station_id *from, size_t n_from, station_id to,
+			    enum report_format format, struct buf *b, struct board_deps *deps);
+void report_error(const char *msg, station_id id, enum report_format format, struct buf *b);
+void departure_json(struct json *j, const struct departure *dep, time_t loaded);
+void board_render(struct station *st, enum report_format format, const struct board_filter *filter,
+		  struct buf *b);
+int board_stream(station_id id, enum report_format format, const struct board_filter *filter,
+		 struct buf *b);
+int report_stream(const station_id *ids, size_t n, enum report_format format,
+		  const struct board_filter *filter, FILE *f);
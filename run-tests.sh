@@ -1,5 +1,8 @@
+cache=`mktemp -d`
+
 function server() {
 	subdir=$1
+	rm -f $cache/*
 	cd ../tests/$subdir
 	python ../server.py 2>&1 >/dev/null  &
 	PID=$!
@@ -12,13 +15,13 @@ function check() {
 	cmd=$2
 	expected=$3
 
-	$cmd > 1~.txt
+	eval "$cmd -C $cache" > 1~.txt
 	diff --brief 1~.txt $expected
 
 	if [[ $? == 1 ]] ; then
 		echo -e "$name" '\x1b[31m' -- FAIL'\x1b[0m'
 		echo command: $cmd
-		colordiff -U 1000 1~.txt ../tests/1.txt
+		colordiff -U 1000 1~.txt $expected
 	else
 		echo "$name" -- OK
 	fi
@@ -29,9 +32,52 @@ sleep 1
 
 check "XG to PO" "./departures -f XG -t PO -s" ../tests/1.txt
 check "XG to PO cached" "./departures -f XG -t PO -s" ../tests/1.txt
+check "XG to PO json" "./departures -f XG -t PO -s -F json" ../tests/1.json
+
+check "name" "./departures -f Sloatsburg -t PO -s" ../tests/1.txt
+check "name prefix" "./departures -f sloats -t PO -s" ../tests/1.txt
+check "name case" "./departures -f XG -t 'port jervis' -s" ../tests/1.txt
+check "name synonym" "./departures -f XG -t 'Port Jervis (SEC)' -s" ../tests/1.txt
+check "name synonym json" "./departures -f XG -t 'Port Jervis (SEC)' -s -F json" ../tests/1.json
+check "name extra words" "./departures -f XG -t 'Hoboken SEC' -s" ../tests/2.txt
+check "name abbreviation" "./departures -f XG -t 'Secaucus Lower Level' -s" ../tests/3.txt
+check "name ambiguous" "./departures -f XG -t Ram -s" ../tests/4.txt
+check "merge" "./departures -f XG -f SF -t HB -s -c 4:40" ../tests/5.txt
+check "merge json" "./departures -f XG -f SF -t HB -s -c 4:40 -F json" ../tests/5.json
+check "planner" "./departures -f XG -f RY -t 17 -s -c 4:40" ../tests/6.txt
+check "planner json" "./departures -f XG -f RY -t 17 -s -c 4:40 -F json" ../tests/6.json
+
+archive=`mktemp -d`
+./departures -f XG -t PO -s -c 4:40 -C $archive -Z $archive > /dev/null
+check "replay" "./departures -Y $archive -f XG -t PO" ../tests/11.txt
+check "replay json" "./departures -Y $archive -f XG -t PO -F json" ../tests/11.json
+rm -rf $archive
+
+kill $PID
+wait 2> /dev/null
+
+server "02"
+sleep 1
+
+check "planner 02" "./departures -f XG -f SF -t TS -s -c 6:31" ../tests/7.txt
+check "planner 02 json" "./departures -f XG -f SF -t TS -s -c 6:31 -F json" ../tests/7.json
+check "merge 02" "./departures -f XG -f SF -t HB -s -c 6:31" ../tests/8.txt
+check "merge 02 json" "./departures -f XG -f SF -t HB -s -c 6:31 -F json" ../tests/8.json
+check "footpath 02" "./departures -f XG -t SE -s -c 6:31" ../tests/10.txt
+check "footpath 02 json" "./departures -f XG -t SE -s -c 6:31 -F json" ../tests/10.json
+
+kill $PID
+wait 2> /dev/null
+
+server "03"
+sleep 1
+
+check "planner 03" "./departures -f XG -f MD -t CW -s -c 6:59" ../tests/9.txt
+check "planner 03 json" "./departures -f XG -f MD -t CW -s -c 6:59 -F json" ../tests/9.json
 
 kill $PID
 wait 2> /dev/null
+rm -rf $cache
 
 
 
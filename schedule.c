@@ -0,0 +1,714 @@
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stations.h"
+#include "schedule.h"
+#include "util.h"
+
+#define SCHED_MAGIC     0x31435344u     /* "DSC1", change with the layout */
+#define SCHED_MAX_DAYS  512             /* days from the first service date */
+#define SCHED_DAY_BYTES (SCHED_MAX_DAYS / 8)
+#define SCHED_TRAIN     8               /* train number, zero padded */
+
+#define GTFS_MAX_FIELDS 32
+#define GTFS_ID         40
+
+/* ===== index layout ======================== */
+
+struct sched_header
+{
+	uint32_t        magic;          /* SCHED_MAGIC */
+	int32_t         base;           /* first day, days since 1970-01-01 */
+	uint32_t        n_days;         /* days covered from base */
+	uint32_t        n_services;     /* day bitmaps, SCHED_DAY_BYTES each */
+	uint32_t        n_trips;        /* trips sorted by train */
+	uint32_t        n_stops;        /* stops of all trips */
+};
+
+struct sched_trip
+{
+	char            train[SCHED_TRAIN];
+	uint16_t        service;        /* day bitmap */
+	uint16_t        n;              /* number of stops */
+	uint32_t        first;          /* first stop */
+};
+
+struct sched_stop
+{
+	uint16_t        min;            /* departure, minutes from noon minus 12h of the day */
+	station_id      id;             /* station */
+	uint8_t         pad;
+};
+
+static const struct sched_header *hdr = NULL;
+static const uint8_t *days = NULL;
+static const struct sched_trip *trips = NULL;
+static const struct sched_stop *stops = NULL;
+
+/* days since 1970-01-01 of the yyyymmdd date */
+static long
+ymd_days(int ymd)
+{
+	long y = ymd / 10000, m = ymd / 100 % 100, d = ymd % 100;
+	long era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* GTFS times count from noon minus 12h, which is midnight but on DST days */
+static time_t
+ymd_start(int ymd)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = ymd / 10000 - 1900;
+	tm.tm_mon = ymd / 100 % 100 - 1;
+	tm.tm_mday = ymd % 100;
+	tm.tm_hour = 12;
+	tm.tm_isdst = -1;
+
+	return mktime(&tm) - 12 * 3600;
+}
+
+/* Maps the schedule index. Returns -1 if there is no valid index. */
+int
+schedule_open(const char *fname)
+{
+	const struct sched_header *h;
+	struct stat sb;
+	size_t sz;
+	void *p;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(struct sched_header)) {
+		close(fd);
+		return -1;
+	}
+
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return -1;
+
+	h = p;
+	sz = sizeof(struct sched_header) + (size_t)h->n_services * SCHED_DAY_BYTES +
+	     (size_t)h->n_trips * sizeof(struct sched_trip) + (size_t)h->n_stops * sizeof(struct sched_stop);
+
+	if (h->magic != SCHED_MAGIC || h->n_days > SCHED_MAX_DAYS || sz != (size_t)sb.st_size) {
+		warnx("Invalid schedule %s", fname);
+		munmap(p, sb.st_size);
+		return -1;
+	}
+
+	days = (const uint8_t *)(h + 1);
+	trips = (const struct sched_trip *)(days + (size_t)h->n_services * SCHED_DAY_BYTES);
+	stops = (const struct sched_stop *)(trips + h->n_trips);
+	hdr = h;
+
+	return 0;
+}
+
+/*
+ * Returns the timetable departure of the train from the station on the
+ * service day of t, 0 if the train doesn't run then or has no schedule.
+ */
+time_t
+schedule_departure(const char *train, station_id id, time_t t)
+{
+	const struct sched_trip *trip;
+	const struct sched_stop *s;
+	size_t lo, hi, mid;
+	long day;
+	int ymd;
+
+	if (hdr == NULL || train == NULL || id == STATION_NONE || strlen(train) >= SCHED_TRAIN)
+		return 0;
+
+	ymd = service_day(t);
+	day = ymd_days(ymd) - hdr->base;
+	if (day < 0 || day >= hdr->n_days)
+		return 0;
+
+	lo = 0;
+	hi = hdr->n_trips;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(trips[mid].train, train, SCHED_TRAIN) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (trip = &trips[lo]; trip < trips + hdr->n_trips && strncmp(trip->train, train, SCHED_TRAIN) == 0; trip++) {
+		if ((days[trip->service * SCHED_DAY_BYTES + day / 8] & (1 << day % 8)) == 0)
+			continue;
+
+		for (s = &stops[trip->first]; s < &stops[trip->first + trip->n]; s++) {
+			if (s->id == id)
+				return ymd_start(ymd) + s->min * 60;
+		}
+	}
+
+	return 0;
+}
+
+/* ===== GTFS import =========================
+ *
+ * The tables are read with unzip -p, so no zip library is needed.
+ */
+
+struct gtfs_table
+{
+	FILE            *f;
+	char            line[1024];
+	char            *fields[GTFS_MAX_FIELDS];
+	int             n;              /* fields in the last row */
+	char            *header[GTFS_MAX_FIELDS];
+	int             n_header;
+};
+
+struct gtfs_stop
+{
+	char            id[GTFS_ID];
+	station_id      station;
+};
+
+struct gtfs_service
+{
+	char            id[GTFS_ID];
+	uint8_t         days[SCHED_DAY_BYTES];
+};
+
+struct gtfs_calendar
+{
+	uint16_t        service;
+	uint8_t         week;           /* bit per weekday, Sunday first */
+	int             start;          /* yyyymmdd */
+	int             end;
+	int             date;           /* calendar_dates row, 0 for calendar */
+	int             type;           /* 1 added, 2 removed */
+};
+
+struct gtfs_trip
+{
+	char            id[GTFS_ID];
+	char            train[SCHED_TRAIN];
+	uint16_t        service;
+};
+
+struct gtfs_time
+{
+	uint32_t        trip;
+	uint32_t        seq;
+	uint16_t        min;
+	station_id      id;
+};
+
+static const struct gtfs_trip *sort_trips;
+
+/* splits a CSV line in place, quoted fields may hold commas */
+static int
+csv_split(char *s, char **fields, int max)
+{
+	char *out;
+	int n = 0;
+
+	s[strcspn(s, "\r\n")] = 0;
+
+	while (n < max) {
+		fields[n++] = out = s;
+
+		if (*s == '"') {
+			for (s++; *s != 0; s++) {
+				if (*s == '"' && s[1] == '"')
+					s++;
+				else if (*s == '"') {
+					s++;
+					break;
+				}
+				*out++ = *s;
+			}
+		} else {
+			for (; *s != 0 && *s != ','; s++)
+				*out++ = *s;
+		}
+
+		if (*s != ',') {
+			*out = 0;
+			break;
+		}
+
+		s++;
+		*out = 0;
+	}
+
+	return n;
+}
+
+static int
+gtfs_open(struct gtfs_table *t, const char *zip, const char *name, int required)
+{
+	char cmd[PATH_MAX + 64];
+	char *h;
+
+	if (strchr(zip, '\'') != NULL)
+		errx(1, "Invalid GTFS file name %s", zip);
+
+	snprintf(cmd, sizeof(cmd), "unzip -p '%s' %s 2>/dev/null", zip, name);
+
+	memset(t, 0, sizeof(struct gtfs_table));
+	t->f = popen(cmd, "r");
+	if (t->f == NULL)
+		err(1, "Cannot run unzip");
+
+	if (fgets(t->line, sizeof(t->line), t->f) == NULL) {
+		pclose(t->f);
+		if (required)
+			errx(1, "No %s in %s", name, zip);
+		return -1;
+	}
+
+	/* skip the UTF-8 byte order mark */
+	h = strncmp(t->line, "\xef\xbb\xbf", 3) == 0 ? t->line + 3 : t->line;
+	h = strdup(h);
+	if (h == NULL)
+		err(1, "Cannot allocate header");
+
+	t->n_header = csv_split(h, t->header, GTFS_MAX_FIELDS);
+
+	return 0;
+}
+
+static int
+gtfs_column(const struct gtfs_table *t, const char *name, int required)
+{
+	int i;
+
+	for (i = 0; i < t->n_header; i++) {
+		if (strcmp(t->header[i], name) == 0)
+			return i;
+	}
+
+	if (required)
+		errx(1, "No %s column", name);
+
+	return -1;
+}
+
+static int
+gtfs_next(struct gtfs_table *t)
+{
+	if (fgets(t->line, sizeof(t->line), t->f) == NULL)
+		return 0;
+
+	t->n = csv_split(t->line, t->fields, GTFS_MAX_FIELDS);
+	return 1;
+}
+
+static const char *
+gtfs_field(const struct gtfs_table *t, int col)
+{
+	return col >= 0 && col < t->n ? t->fields[col] : "";
+}
+
+static void
+gtfs_close(struct gtfs_table *t)
+{
+	pclose(t->f);
+	free(t->header[0]);
+}
+
+/* grows the array to hold n + 1 elements */
+static void *
+grow(void *p, size_t n, size_t *cap, size_t size)
+{
+	if (n < *cap)
+		return p;
+
+	*cap = *cap == 0 ? 256 : *cap * 2;
+	p = realloc(p, *cap * size);
+	if (p == NULL)
+		err(1, "Cannot allocate %zu bytes", *cap * size);
+
+	return p;
+}
+
+static int
+compare_stop(const void *a, const void *b)
+{
+	return strcmp(((const struct gtfs_stop *)a)->id, ((const struct gtfs_stop *)b)->id);
+}
+
+static int
+compare_trip(const void *a, const void *b)
+{
+	return strcmp(((const struct gtfs_trip *)a)->id, ((const struct gtfs_trip *)b)->id);
+}
+
+/* orders stop times by train, then trip and stop sequence */
+static int
+compare_time(const void *a, const void *b)
+{
+	const struct gtfs_time *x = a, *y = b;
+	int rc = strncmp(sort_trips[x->trip].train, sort_trips[y->trip].train, SCHED_TRAIN);
+
+	if (rc != 0)
+		return rc;
+	if (x->trip != y->trip)
+		return x->trip < y->trip ? -1 : 1;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static uint16_t
+service_find(struct gtfs_service **services, size_t *n, size_t *cap, const char *id)
+{
+	size_t i;
+
+	for (i = 0; i < *n; i++) {
+		if (strcmp((*services)[i].id, id) == 0)
+			return i;
+	}
+
+	if (*n == UINT16_MAX)
+		errx(1, "Too many services");
+
+	*services = grow(*services, *n, cap, sizeof(struct gtfs_service));
+	memset(&(*services)[*n], 0, sizeof(struct gtfs_service));
+	snprintf((*services)[*n].id, GTFS_ID, "%s", id);
+
+	return (*n)++;
+}
+
+static size_t
+import_stops(const char *zip, struct gtfs_stop **out)
+{
+	struct gtfs_table t;
+	struct gtfs_stop *s = NULL;
+	size_t n = 0, cap = 0;
+	int c_id, c_name;
+	station_id st;
+
+	gtfs_open(&t, zip, "stops.txt", 1);
+	c_id = gtfs_column(&t, "stop_id", 1);
+	c_name = gtfs_column(&t, "stop_name", 1);
+
+	while (gtfs_next(&t)) {
+		st = station_by_name(gtfs_field(&t, c_name));
+		if (st == STATION_NONE)
+			continue;
+
+		s = grow(s, n, &cap, sizeof(struct gtfs_stop));
+		snprintf(s[n].id, GTFS_ID, "%s", gtfs_field(&t, c_id));
+		s[n].station = st;
+		n++;
+	}
+
+	gtfs_close(&t);
+	qsort(s, n, sizeof(struct gtfs_stop), compare_stop);
+
+	*out = s;
+	return n;
+}
+
+/* reads calendar.txt and calendar_dates.txt into day bitmaps from *base */
+static size_t
+import_calendar(const char *zip, struct gtfs_service **out, long *base, uint32_t *n_days)
+{
+	const char *weekdays[] = { "sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday" };
+	struct gtfs_table t;
+	struct gtfs_service *services = NULL;
+	struct gtfs_calendar *cal = NULL, *c;
+	size_t n = 0, cap = 0, n_cal = 0, cap_cal = 0, i;
+	long first = LONG_MAX, last = LONG_MIN, d, from, to;
+	int c_service, c_week[7], c_start, c_end, c_date, c_type, w;
+
+	if (gtfs_open(&t, zip, "calendar.txt", 0) == 0) {
+		c_service = gtfs_column(&t, "service_id", 1);
+		for (w = 0; w < 7; w++)
+			c_week[w] = gtfs_column(&t, weekdays[w], 1);
+		c_start = gtfs_column(&t, "start_date", 1);
+		c_end = gtfs_column(&t, "end_date", 1);
+
+		while (gtfs_next(&t)) {
+			cal = grow(cal, n_cal, &cap_cal, sizeof(struct gtfs_calendar));
+			c = &cal[n_cal++];
+			memset(c, 0, sizeof(struct gtfs_calendar));
+			c->service = service_find(&services, &n, &cap, gtfs_field(&t, c_service));
+			for (w = 0; w < 7; w++) {
+				if (atoi(gtfs_field(&t, c_week[w])) == 1)
+					c->week |= 1 << w;
+			}
+			c->start = atoi(gtfs_field(&t, c_start));
+			c->end = atoi(gtfs_field(&t, c_end));
+		}
+
+		gtfs_close(&t);
+	}
+
+	if (gtfs_open(&t, zip, "calendar_dates.txt", 0) == 0) {
+		c_service = gtfs_column(&t, "service_id", 1);
+		c_date = gtfs_column(&t, "date", 1);
+		c_type = gtfs_column(&t, "exception_type", 1);
+
+		while (gtfs_next(&t)) {
+			cal = grow(cal, n_cal, &cap_cal, sizeof(struct gtfs_calendar));
+			c = &cal[n_cal++];
+			memset(c, 0, sizeof(struct gtfs_calendar));
+			c->service = service_find(&services, &n, &cap, gtfs_field(&t, c_service));
+			c->date = atoi(gtfs_field(&t, c_date));
+			c->type = atoi(gtfs_field(&t, c_type));
+		}
+
+		gtfs_close(&t);
+	}
+
+	if (n_cal == 0)
+		errx(1, "No calendar.txt or calendar_dates.txt in %s", zip);
+
+	for (i = 0; i < n_cal; i++) {
+		c = &cal[i];
+		from = ymd_days(c->date != 0 ? c->date : c->start);
+		to = ymd_days(c->date != 0 ? c->date : c->end);
+		if (from < first)
+			first = from;
+		if (to > last)
+			last = to;
+	}
+
+	*base = first;
+	*n_days = last - first + 1 < SCHED_MAX_DAYS ? last - first + 1 : SCHED_MAX_DAYS;
+
+	/* regular service first, calendar_dates exceptions apply on top of it */
+	for (i = 0; i < n_cal; i++) {
+		c = &cal[i];
+		if (c->date != 0)
+			continue;
+
+		to = ymd_days(c->end) - first;
+		for (d = ymd_days(c->start) - first; d <= to && d < *n_days; d++) {
+			/* 1970-01-01 was a Thursday */
+			if ((c->week & 1 << (d + first + 4) % 7) != 0)
+				services[c->service].days[d / 8] |= 1 << d % 8;
+		}
+	}
+
+	for (i = 0; i < n_cal; i++) {
+		c = &cal[i];
+		d = ymd_days(c->date) - first;
+		if (c->date == 0 || d >= *n_days)
+			continue;
+
+		if (c->type == 1)
+			services[c->service].days[d / 8] |= 1 << d % 8;
+		else if (c->type == 2)
+			services[c->service].days[d / 8] &= ~(1 << d % 8);
+	}
+
+	free(cal);
+
+	*out = services;
+	return n;
+}
+
+static size_t
+import_trips(const char *zip, struct gtfs_service **services, size_t *n_services, struct gtfs_trip **out)
+{
+	struct gtfs_table t;
+	struct gtfs_trip *trips = NULL;
+	size_t n = 0, cap = 0, cap_services = *n_services;
+	int c_id, c_service, c_train, c_block;
+	const char *train;
+
+	gtfs_open(&t, zip, "trips.txt", 1);
+	c_id = gtfs_column(&t, "trip_id", 1);
+	c_service = gtfs_column(&t, "service_id", 1);
+	c_train = gtfs_column(&t, "trip_short_name", 0);
+	c_block = gtfs_column(&t, "block_id", 0);
+
+	if (c_train < 0 && c_block < 0)
+		errx(1, "No trip_short_name or block_id column");
+
+	while (gtfs_next(&t)) {
+		train = gtfs_field(&t, c_train);
+		if (*train == 0)
+			train = gtfs_field(&t, c_block);
+
+		/* the boards show train numbers without leading zeros */
+		while (*train == '0' && train[1] != 0)
+			train++;
+
+		if (*train == 0 || strlen(train) >= SCHED_TRAIN)
+			continue;
+
+		trips = grow(trips, n, &cap, sizeof(struct gtfs_trip));
+		memset(&trips[n], 0, sizeof(struct gtfs_trip));
+		snprintf(trips[n].id, GTFS_ID, "%s", gtfs_field(&t, c_id));
+		strcpy(trips[n].train, train);
+		trips[n].service = service_find(services, n_services, &cap_services, gtfs_field(&t, c_service));
+		n++;
+	}
+
+	gtfs_close(&t);
+	qsort(trips, n, sizeof(struct gtfs_trip), compare_trip);
+
+	*out = trips;
+	return n;
+}
+
+static size_t
+import_times(const char *zip, const struct gtfs_stop *gstops, size_t n_gstops,
+	     const struct gtfs_trip *gtrips, size_t n_gtrips, struct gtfs_time **out)
+{
+	struct gtfs_table t;
+	struct gtfs_time *times = NULL;
+	struct gtfs_stop skey, *s;
+	struct gtfs_trip tkey, *tr;
+	size_t n = 0, cap = 0;
+	int c_trip, c_dep, c_stop, c_seq, h, m;
+
+	gtfs_open(&t, zip, "stop_times.txt", 1);
+	c_trip = gtfs_column(&t, "trip_id", 1);
+	c_dep = gtfs_column(&t, "departure_time", 1);
+	c_stop = gtfs_column(&t, "stop_id", 1);
+	c_seq = gtfs_column(&t, "stop_sequence", 1);
+
+	while (gtfs_next(&t)) {
+		snprintf(skey.id, GTFS_ID, "%s", gtfs_field(&t, c_stop));
+		s = bsearch(&skey, gstops, n_gstops, sizeof(struct gtfs_stop), compare_stop);
+		if (s == NULL)
+			continue;
+
+		snprintf(tkey.id, GTFS_ID, "%s", gtfs_field(&t, c_trip));
+		tr = bsearch(&tkey, gtrips, n_gtrips, sizeof(struct gtfs_trip), compare_trip);
+		if (tr == NULL)
+			continue;
+
+		/* hours run past 24 for trips after midnight */
+		if (sscanf(gtfs_field(&t, c_dep), "%d:%d", &h, &m) != 2 || h < 0 || h > 47 || m < 0 || m > 59)
+			continue;
+
+		times = grow(times, n, &cap, sizeof(struct gtfs_time));
+		times[n].trip = tr - gtrips;
+		times[n].seq = atoi(gtfs_field(&t, c_seq));
+		times[n].min = h * 60 + m;
+		times[n].id = s->station;
+		n++;
+	}
+
+	gtfs_close(&t);
+
+	*out = times;
+	return n;
+}
+
+/*
+ * Converts the GTFS zip into the schedule index fname. The index is
+ * written aside and renamed over fname, so running processes keep the
+ * index they mapped.
+ */
+int
+schedule_import(const char *zip, const char *fname)
+{
+	struct gtfs_stop *gstops;
+	struct gtfs_service *services;
+	struct gtfs_trip *gtrips;
+	struct gtfs_time *times;
+	struct sched_header h;
+	struct sched_trip trip;
+	struct sched_stop stop;
+	char tmp[PATH_MAX];
+	size_t n_gstops, n_services, n_gtrips, n_times, i;
+	long base;
+	FILE *f;
+
+	n_gstops = import_stops(zip, &gstops);
+	n_services = import_calendar(zip, &services, &base, &h.n_days);
+	n_gtrips = import_trips(zip, &services, &n_services, &gtrips);
+	n_times = import_times(zip, gstops, n_gstops, gtrips, n_gtrips, &times);
+
+	sort_trips = gtrips;
+	qsort(times, n_times, sizeof(struct gtfs_time), compare_time);
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+	f = fopen(tmp, "wb");
+	if (f == NULL)
+		err(1, "Cannot create %s", tmp);
+
+	h.magic = 0;
+	h.base = base;
+	h.n_services = n_services;
+	h.n_trips = 0;
+	h.n_stops = n_times;
+
+	/* the header is rewritten with the magic once the rest is written */
+	fwrite(&h, sizeof(h), 1, f);
+	for (i = 0; i < n_services; i++)
+		fwrite(services[i].days, SCHED_DAY_BYTES, 1, f);
+
+	memset(&trip, 0, sizeof(trip));
+	for (i = 0; i < n_times; i++) {
+		if (i > 0 && times[i].trip == times[i - 1].trip)
+			continue;
+
+		if (i > 0)
+			fwrite(&trip, sizeof(trip), 1, f);
+
+		memcpy(trip.train, gtrips[times[i].trip].train, SCHED_TRAIN);
+		trip.service = gtrips[times[i].trip].service;
+		trip.first = i;
+		trip.n = 0;
+		h.n_trips++;
+
+		/* a trip's stops are contiguous after the sort */
+		while (i + trip.n < n_times && times[i + trip.n].trip == times[i].trip && trip.n < UINT16_MAX)
+			trip.n++;
+	}
+	if (n_times > 0)
+		fwrite(&trip, sizeof(trip), 1, f);
+
+	memset(&stop, 0, sizeof(stop));
+	for (i = 0; i < n_times; i++) {
+		stop.min = times[i].min;
+		stop.id = times[i].id;
+		fwrite(&stop, sizeof(stop), 1, f);
+	}
+
+	h.magic = SCHED_MAGIC;
+	if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1 || fclose(f) != 0)
+		err(1, "Cannot write %s", tmp);
+
+	if (rename(tmp, fname) != 0)
+		err(1, "Cannot rename %s", tmp);
+
+	printf("stops %zu services %zu trips %u stop times %zu days %u\n",
+	       n_gstops, n_services, h.n_trips, n_times, h.n_days);
+
+	free(gstops);
+	free(services);
+	free(gtrips);
+	free(times);
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include <time.h>
+
+/*
+ * Scheduled departures from the NJ Transit GTFS timetable.
+ *
+ * schedule_import() converts the stops, trips, stop_times and calendar
+ * tables of a GTFS zip into a compact index file: the days every service
+ * runs as bitmaps, trips sorted by train number, and the departure minute
+ * of every trip at every station of stations.txt. schedule_open() maps
+ * the index read-only, so a lookup is a binary search over the trips and
+ * a scan of one train's stops, without allocating.
+ */
+
+#define SCHEDULE_FILE   "/var/tmp/departures-schedule.idx"
+
+int schedule_import(const char *zip, const char *fname);
+int schedule_open(const char *fname);
+time_t schedule_departure(const char *train, station_id id, time_t t);
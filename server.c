@@ -0,0 +1,226 @@
+#include <err.h>
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common/net.h"
+#include "stations.h"
+#include "api.h"
+#include "board.h"
+#include "events.h"
+#include "server.h"
+#include "util.h"
+#include "log.h"
+
+#define MAX_REQUEST     4096
+#define MAX_WORKERS     64
+#define RECV_TIMEOUT    10
+
+static const char *
+status_text(int status)
+{
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 503: return "Service Unavailable";
+	default:  return "Internal Server Error";
+	}
+}
+
+static int
+send_all(int fd, const char *s, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, s, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		s += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+read_request(int fd, char *req, size_t sz)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	while (len + 1 < sz) {
+		n = recv(fd, &req[len], sz - len - 1, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		len += n;
+		req[len] = 0;
+		if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Serves one request. Returns 0 if the socket was handed over to the
+ * event stream and must stay open.
+ */
+static int
+serve_client(int fd)
+{
+	char req[MAX_REQUEST];
+	char method[8], path[1024], head[256], code[8];
+	station_id station;
+	struct api_reply r;
+	size_t len;
+	int n;
+
+	if (read_request(fd, req, sizeof(req)) != 0)
+		return 1;
+
+	query_begin();
+	memset(&r, 0, sizeof(struct api_reply));
+	method[0] = path[0] = '\0';
+
+	if (sscanf(req, "%7s %1023s", method, path) != 2) {
+		r.status = 400;
+	} else if (strcmp(method, "GET") != 0) {
+		r.status = 405;
+	} else if (sscanf(path, "/v1/events/%7[^/?]", code) == 1) {
+		station = station_find(code);
+		if (station == STATION_NONE)
+			r.status = 404;
+		else if (events_subscribe(fd, station) == 0)
+			return 0;
+		else
+			r.status = 503;     /* too many topics or no board */
+	} else {
+		api_handle(path, &r);
+	}
+
+	if (r.content_type == NULL)
+		r.content_type = "text/plain; charset=utf-8";
+
+	len = r.body.s != NULL ? strlen(r.body.s) : 0;
+
+	n = snprintf(head, sizeof(head),
+		"HTTP/1.0 %d %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %zu\r\n"
+		"Connection: close\r\n"
+		"\r\n",
+		r.status, status_text(r.status), r.content_type, len);
+
+	if (send_all(fd, head, n) == 0 && len > 0)
+		send_all(fd, r.body.s, len);
+
+	log_add(LEVEL_INFO, "request status", method, r.status, path, strlen(path));
+	log_num(LEVEL_DEBUG, "reply bytes", method, len);
+
+	api_reply_free(&r);
+	return 1;
+}
+
+static void *
+worker(void *arg)
+{
+	int lfd = *(int *)arg;
+	int fd;
+	struct timeval tv = { .tv_sec = RECV_TIMEOUT };
+
+	for (;;) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				warn("accept");
+			continue;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		if (serve_client(fd))
+			close(fd);
+	}
+
+	return NULL;
+}
+
+static int
+listen_on(const char *port)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd = -1, on = 1, rc;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	rc = getaddrinfo(NULL, port, &hints, &res);
+	if (rc != 0)
+		errx(1, "getaddrinfo: %s", gai_strerror(rc));
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0)
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	return fd;
+}
+
+/*
+ * Serves the API on port with a pool of worker threads blocked in accept().
+ * Workers share station boards through board_get() snapshots.
+ */
+int
+server_run(const char *port, int workers)
+{
+	pthread_t threads[MAX_WORKERS];
+	int i, lfd;
+
+	if (workers < 1 || workers > MAX_WORKERS)
+		errx(1, "Number of workers must be between 1 and %d", MAX_WORKERS);
+
+	signal(SIGPIPE, SIG_IGN);
+
+	lfd = listen_on(port);
+	if (lfd < 0)
+		err(1, "Cannot listen on port %s", port);
+
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&threads[i], NULL, worker, &lfd) != 0)
+			errx(1, "Cannot create worker thread");
+	}
+
+	for (i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+
+	close(lfd);
+	return 0;
+}
@@ -0,0 +1 @@
+int server_run(const char *port, int workers);
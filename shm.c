@@ -0,0 +1,282 @@
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stations.h"
+#include "board.h"
+#include "parser.h"
+#include "shm.h"
+#include "schedule.h"
+#include "log.h"
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+#define SHM_NAME        "/departures-boards"
+#define SHM_MAGIC       0x44425332u     /* "DBS2", change with the layout */
+#define SHM_MAX_ROWS    48              /* larger boards are not shared */
+
+struct shm_row
+{
+	char            time[8];        /* departure time */
+	char            train[8];       /* train label or number */
+	char            track[8];       /* departure track */
+	char            line[32];       /* rail route name */
+	char            status[32];     /* train status */
+	char            destination[40];/* destination as shown on the page */
+	station_id      dest;           /* destination station */
+	uint8_t         has_status;     /* the row had a status cell */
+};
+
+struct shm_slot
+{
+	atomic_uint     seq;            /* odd while a writer copies rows in */
+	uint64_t        ino;            /* page file the rows were parsed from */
+	int64_t         size;
+	int64_t         mtime;          /* page mtime, nanoseconds */
+	int64_t         loaded;         /* time the page was parsed */
+	uint32_t        n;              /* number of rows */
+	struct shm_row  rows[SHM_MAX_ROWS];
+};
+
+struct shm_segment
+{
+	atomic_uint     magic;          /* shm_magic() once initialized */
+	struct shm_slot slots[STATION_NONE];
+};
+
+/* slot fields copied by readers, everything after the seqlock */
+#define SLOT_DATA       offsetof(struct shm_slot, ino)
+
+static struct shm_segment *seg = NULL;
+static pthread_once_t shm_once = PTHREAD_ONCE_INIT;
+
+/* slots are indexed by station id, so the station table is part of the layout */
+static unsigned
+shm_magic()
+{
+	uint32_t h = 2166136261u;       /* FNV-1a */
+	const char *p;
+	size_t i;
+
+	for (i = 0; i < n_stations; i++) {
+		for (p = station_defs[i].code; *p != 0; p++)
+			h = (h ^ (unsigned char)*p) * 16777619u;
+		h = (h ^ '|') * 16777619u;
+		for (p = station_defs[i].name; *p != 0; p++)
+			h = (h ^ (unsigned char)*p) * 16777619u;
+		h = (h ^ '\n') * 16777619u;
+	}
+
+	/* 0 marks a new segment */
+	return (SHM_MAGIC ^ h) != 0 ? SHM_MAGIC ^ h : SHM_MAGIC;
+}
+
+static void
+shm_map()
+{
+	struct shm_segment *s;
+	struct stat sb;
+	unsigned magic = 0, want = shm_magic();
+	void *p;
+	int fd;
+
+	fd = shm_open(SHM_NAME, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &sb) != 0 ||
+	    (sb.st_size < (off_t)sizeof(struct shm_segment) && ftruncate(fd, sizeof(struct shm_segment)) != 0)) {
+		close(fd);
+		return;
+	}
+
+	p = mmap(NULL, sizeof(struct shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return;
+
+	/* a segment left by a build with another layout or station table is not used */
+	s = p;
+	if (!atomic_compare_exchange_strong(&s->magic, &magic, want) && magic != want) {
+		munmap(p, sizeof(struct shm_segment));
+		return;
+	}
+
+	seg = s;
+}
+
+static struct shm_slot *
+shm_slot(station_id id)
+{
+	pthread_once(&shm_once, shm_map);
+
+	if (seg == NULL || id >= n_stations)
+		return NULL;
+
+	return &seg->slots[id];
+}
+
+static int64_t
+page_mtime(const struct stat *page)
+{
+	return (int64_t)page->st_mtim.tv_sec * 1000000000 + page->st_mtim.tv_nsec;
+}
+
+static int
+field_fits(const char *s, size_t sz)
+{
+	return s == NULL || strlen(s) < sz;
+}
+
+/*
+ * Builds the board of st from the shared slot if the slot was parsed from
+ * the page file described by page. Returns -1 if the page has to be parsed.
+ */
+int
+shm_board_get(struct station *st, const struct stat *page)
+{
+	struct shm_slot *slot = shm_slot(st->id);
+	struct shm_slot *copy;
+	struct departure *dep, *last = NULL;
+	struct shm_row *row;
+	unsigned seq;
+	uint32_t i;
+
+	if (slot == NULL)
+		return -1;
+
+	seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq == 0 || (seq & 1) != 0)
+		return -1;
+
+	copy = malloc(sizeof(struct shm_slot));
+	if (copy == NULL)
+		return -1;
+
+	memcpy((char *)copy + SLOT_DATA, (char *)slot + SLOT_DATA, sizeof(struct shm_slot) - SLOT_DATA);
+
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq ||
+	    copy->ino != (uint64_t)page->st_ino || copy->size != (int64_t)page->st_size ||
+	    copy->mtime != page_mtime(page) || copy->n > SHM_MAX_ROWS) {
+		free(copy);
+		return -1;
+	}
+
+	st->deps = calloc(1, sizeof(struct departures));
+	if (st->deps == NULL)
+		err(1, "Cannot allocate deps");
+
+	st->deps->list = calloc(1, sizeof(struct departure_list));
+	SLIST_INIT(st->deps->list);
+
+	st->text = calloc(1, sizeof(struct strpool));
+	if (st->text == NULL)
+		err(1, "Cannot allocate strings");
+
+	for (i = 0; i < copy->n; i++) {
+		row = &copy->rows[i];
+
+		dep = calloc(1, sizeof(struct departure));
+		if (dep == NULL)
+			err(1, "Cannot allocate departure");
+
+		dep->time = strpool_add(st->text, row->time, strlen(row->time));
+		dep->train = strpool_add(st->text, row->train, strlen(row->train));
+		dep->track = strpool_add(st->text, row->track, strlen(row->track));
+		dep->line = strpool_add(st->text, row->line, strlen(row->line));
+		dep->status = row->has_status ? strpool_add(st->text, row->status, strlen(row->status)) : NULL;
+		dep->dest = row->dest;
+		dep->scheduled = schedule_departure(dep->train, st->id, copy->loaded);
+		dep->destination = dep->dest != STATION_NONE ? (char *)station_name(dep->dest) :
+				   strpool_add(st->text, row->destination, strlen(row->destination));
+
+		if (last == NULL)
+			SLIST_INSERT_HEAD(st->deps->list, dep, entries);
+		else
+			SLIST_INSERT_AFTER(last, dep, entries);
+
+		last = dep;
+		st->deps->size++;
+	}
+
+	st->bytes = sizeof(struct station) + sizeof(struct departures) + sizeof(struct departure_list) +
+		    st->deps->size * sizeof(struct departure) + sizeof(struct strpool) + st->text->bytes;
+	st->loaded = copy->loaded;
+
+	log_num(LEVEL_INFO, "shared memory rows", station_code(st->id), copy->n);
+
+	free(copy);
+
+	return 0;
+}
+
+/*
+ * Publishes the parsed board of st for other processes. Boards that don't
+ * fit a slot, and slots another writer is filling, are skipped. A slot is
+ * never taken over from its writer, which may only be stalled; one that
+ * died while filling it leaves the station to parsing.
+ */
+void
+shm_board_put(const struct station *st, const struct stat *page)
+{
+	struct shm_slot *slot = shm_slot(st->id);
+	struct departure *dep;
+	struct shm_row *row;
+	unsigned seq;
+	uint32_t n = 0;
+
+	if (slot == NULL || st->deps->size > SHM_MAX_ROWS)
+		return;
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		if (!field_fits(dep->time, sizeof(row->time)) ||
+		    !field_fits(dep->train, sizeof(row->train)) ||
+		    !field_fits(dep->track, sizeof(row->track)) ||
+		    !field_fits(dep->line, sizeof(row->line)) ||
+		    !field_fits(dep->status, sizeof(row->status)) ||
+		    !field_fits(dep->destination, sizeof(row->destination)))
+			return;
+	}
+
+	seq = atomic_load(&slot->seq);
+	if ((seq & 1) != 0 || !atomic_compare_exchange_strong(&slot->seq, &seq, seq + 1))
+		return;
+
+	atomic_thread_fence(memory_order_release);
+
+	SLIST_FOREACH(dep, st->deps->list, entries) {
+		row = &slot->rows[n++];
+		memset(row, 0, sizeof(struct shm_row));
+		strcpy(row->time, dep->time);
+		strcpy(row->train, dep->train);
+		strcpy(row->track, dep->track);
+		strcpy(row->line, dep->line);
+		strcpy(row->destination, dep->destination);
+		if (dep->status != NULL) {
+			strcpy(row->status, dep->status);
+			row->has_status = 1;
+		}
+		row->dest = dep->dest;
+	}
+
+	slot->n = n;
+	slot->ino = page->st_ino;
+	slot->size = page->st_size;
+	slot->mtime = page_mtime(page);
+	slot->loaded = st->loaded;
+
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
@@ -0,0 +1,16 @@
+/*
+ * Parsed boards shared between processes.
+ *
+ * Every station has a fixed slot in one /dev/shm segment holding the rows
+ * of its last parsed page and the identity (inode, size, mtime) of that
+ * page. A process that finds the slot parsed from the page file on disk
+ * copies the rows instead of parsing the file again. Slots are seqlocks:
+ * a writer makes the sequence odd while it copies rows in, readers retry
+ * or fall back to parsing when the sequence is odd or changed under them.
+ */
+
+struct stat;
+struct station;
+
+int shm_board_get(struct station *st, const struct stat *page);
+void shm_board_put(const struct station *st, const struct stat *page);
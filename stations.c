@@ -1,7 +1,10 @@
+#include <ctype.h>
+#include <err.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
-#include "stations_defs.c"
+#include "stations.h"
 
 const char credits[] =
 	"\n"
@@ -13,60 +16,317 @@ const char credits[] =
 const size_t sz_credits = sizeof(credits);
 
 void
-stations_list()
+stations_list(FILE *f)
 {
-	int i;
+	size_t i;
 	for (i = 0; i < n_stations; i++) {
-		printf("%-40s    %2s\n", stations[i], codes[i]);
+		fprintf(f, "%-40s    %2s\n", station_defs[i].name, station_defs[i].code);
 	}
 
 }
 
+const char *
+station_code(station_id id)
+{
+	return id < n_stations ? station_defs[id].code : NULL;
+}
+
+const char *
+station_name(station_id id)
+{
+	return id < n_stations ? station_defs[id].name : NULL;
+}
+
+unsigned
+station_lines(station_id id)
+{
+	return id < n_stations ? station_defs[id].lines : 0;
+}
+
+/* ===== station name trie ==================
+ *
+ * Names and synonyms are normalized (lowercase, entities and tags dropped,
+ * punctuation folded to single spaces, common abbreviations expanded) and
+ * stored in a first-child/next-sibling trie. Every node remembers the
+ * station shared by all names below it, so a user prefix resolves in the
+ * same walk as an exact name.
+ */
+
+#define TRIE_MAX_NODES  4096
+#define TRIE_NONE       -1
+#define TRIE_AMBIGUOUS  -2
+#define CODE_CHARS      36
+
+struct trie_node
+{
+	char            ch;             /* edge label */
+	short           station;        /* station id if a name ends here */
+	short           uniq;           /* station id for the whole subtree */
+	unsigned short  child;          /* first child node, 0 if none */
+	unsigned short  sibling;        /* next sibling node, 0 if none */
+};
+
+static struct trie_node trie[TRIE_MAX_NODES];
+static size_t trie_size = 0;
+static station_id by_code[CODE_CHARS * CODE_CHARS];  /* two character code to id */
+static pthread_once_t stations_once = PTHREAD_ONCE_INIT;
+
+static const char *abbrevs[][2] = {
+	{ "av",   "avenue" },
+	{ "ave",  "avenue" },
+	{ "jct",  "junction" },
+	{ "lk",   "lake" },
+	{ "lvl",  "level" },
+	{ "mt",   "mount" },
+	{ "sta",  "station" },
+	{ "st",   "street" },
+};
+
+static void
+append_word(const char *word, size_t wlen, char *out, size_t *n, size_t sz)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(abbrevs) / sizeof(abbrevs[0]); i++) {
+		if (strlen(abbrevs[i][0]) == wlen && strncmp(abbrevs[i][0], word, wlen) == 0) {
+			word = abbrevs[i][1];
+			wlen = strlen(word);
+			break;
+		}
+	}
+
+	if (*n > 0 && *n + 1 < sz)
+		out[(*n)++] = ' ';
+
+	for (i = 0; i < wlen && *n + 1 < sz; i++)
+		out[(*n)++] = word[i];
+}
+
 size_t
-station_index(const char *code)
+station_normalize(const char *name, size_t len, char *out, size_t sz)
 {
-	int i;
-	for (i = 0; i < n_stations; i++) {
-		if (strcmp(code, codes[i]) == 0)
-			return i;
+	char word[64];
+	size_t wlen = 0, n = 0, i;
+	const char *end;
+
+	if (sz == 0)
+		return 0;
+
+	for (i = 0; i <= len; i++) {
+		char ch = i < len ? name[i] : 0;
+
+		if (ch == '&' && (end = memchr(&name[i], ';', len - i)) != NULL && end - &name[i] < 8) {
+			/* &nbsp; &amp; and friends are word separators */
+			i = end - name;
+			ch = ' ';
+		} else if (ch == '&' && len - i >= 5 && strncmp(&name[i], "&nbsp", 5) == 0) {
+			i += 4;
+			ch = ' ';
+		} else if (ch == '<' && (end = memchr(&name[i], '>', len - i)) != NULL) {
+			i = end - name;
+			ch = ' ';
+		}
+
+		if (isalnum((unsigned char)ch)) {
+			if (wlen < sizeof(word))
+				word[wlen++] = tolower((unsigned char)ch);
+			continue;
+		}
+
+		if (wlen > 0)
+			append_word(word, wlen, out, &n, sz);
+		wlen = 0;
+
+		if (ch == 0)
+			break;
 	}
-	return -1;
+
+	out[n] = 0;
+	return n;
 }
 
-const char *
-station_name(const char *code)
+static unsigned short
+trie_child(unsigned short node, char ch, int create)
 {
-	int i;
-	for (i = 0; i < n_stations; i++) {
-		if (strcmp(code, codes[i]) == 0)
-			return stations[i];
+	unsigned short c, last = 0;
+
+	for (c = trie[node].child; c != 0; c = trie[c].sibling) {
+		if (trie[c].ch == ch)
+			return c;
+		last = c;
 	}
-	return NULL;
+
+	if (!create)
+		return 0;
+
+	if (trie_size >= TRIE_MAX_NODES)
+		errx(1, "station trie is full");
+
+	c = trie_size++;
+	trie[c].ch = ch;
+	trie[c].station = TRIE_NONE;
+	trie[c].uniq = TRIE_NONE;
+
+	if (last == 0)
+		trie[node].child = c;
+	else
+		trie[last].sibling = c;
+
+	return c;
 }
 
-const char *
-station_code(const char *name)
+static short
+trie_merge(short a, short b)
+{
+	if (a == TRIE_NONE)
+		return b;
+	if (b == TRIE_NONE || a == b)
+		return a;
+	return TRIE_AMBIGUOUS;
+}
+
+static short
+trie_fill_uniq(unsigned short node)
 {
-	int i;
+	unsigned short c;
+	short uniq = trie[node].station;
+
+	for (c = trie[node].child; c != 0; c = trie[c].sibling)
+		uniq = trie_merge(uniq, trie_fill_uniq(c));
+
+	trie[node].uniq = uniq;
+	return uniq;
+}
+
+static void
+trie_insert(const char *name, station_id id)
+{
+	char key[128];
+	size_t k, len;
+	unsigned short node = 0;
+
+	len = station_normalize(name, strlen(name), key, sizeof(key));
+	if (len == 0)
+		return;
+
+	for (k = 0; k < len; k++)
+		node = trie_child(node, key[k], 1);
+
+	if (trie[node].station == TRIE_NONE)
+		trie[node].station = id;
+}
+
+static int
+code_slot(const char *code)
+{
+	const char *digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	const char *a, *b;
+
+	if (code[0] == 0 || code[1] == 0 || code[2] != 0)
+		return -1;
+
+	a = strchr(digits, toupper((unsigned char)code[0]));
+	b = strchr(digits, toupper((unsigned char)code[1]));
+	if (a == NULL || b == NULL)
+		return -1;
+
+	return (a - digits) * CODE_CHARS + (b - digits);
+}
+
+static void
+stations_init()
+{
+	size_t i;
+	int slot;
+
+	memset(by_code, STATION_NONE, sizeof(by_code));
+
 	for (i = 0; i < n_stations; i++) {
-		if (strcmp(name, stations[i]) == 0)
-			return codes[i];
+		slot = code_slot(station_defs[i].code);
+		if (slot < 0)
+			errx(1, "bad station code %s", station_defs[i].code);
+		by_code[slot] = i;
 	}
-	return NULL;
+
+	trie_size = 1;
+	trie[0].station = TRIE_NONE;
+
+	for (i = 0; i < n_stations; i++)
+		trie_insert(station_defs[i].name, i);
+
+	for (i = 0; i < n_synonyms; i++)
+		trie_insert(station_synonyms[i].name, station_synonyms[i].id);
+
+	trie_fill_uniq(0);
 }
 
-const char *
-station_verify_code(const char *code)
+/*
+ * Walks the normalized name once. Returns the station index for an exact
+ * name, for the longest name followed by extra words ("Hoboken SEC") or,
+ * when prefix is set, for an unambiguous prefix. Returns TRIE_NONE otherwise.
+ */
+static short
+trie_lookup(const char *name, size_t len, int prefix)
 {
-	if (code == NULL)
-		return NULL;
+	char key[128];
+	size_t k;
+	unsigned short node = 0;
+	short longest = TRIE_NONE;
 
-	int i;
-	for (i = 0; i < n_stations; i++) {
-		if (strcmp(code, codes[i]) == 0)
-			return codes[i];
+	pthread_once(&stations_once, stations_init);
+
+	len = station_normalize(name, len, key, sizeof(key));
+	if (len == 0)
+		return TRIE_NONE;
+
+	for (k = 0; k < len; k++) {
+		if (key[k] == ' ' && trie[node].station >= 0)
+			longest = trie[node].station;
+
+		node = trie_child(node, key[k], 0);
+		if (node == 0)
+			return longest;
 	}
-	return NULL;
+
+	if (trie[node].station >= 0)
+		return trie[node].station;
+
+	if (prefix && trie[node].uniq >= 0)
+		return trie[node].uniq;
+
+	return longest;
 }
 
+station_id
+station_by_name(const char *name)
+{
+	short id = trie_lookup(name, strlen(name), 0);
+	return id >= 0 ? id : STATION_NONE;
+}
 
+station_id
+station_lookup(const char *code)
+{
+	int slot;
+
+	if (code == NULL || (slot = code_slot(code)) < 0)
+		return STATION_NONE;
+
+	pthread_once(&stations_once, stations_init);
+
+	return by_code[slot];
+}
+
+station_id
+station_find(const char *input)
+{
+	if (input == NULL)
+		return STATION_NONE;
+
+	station_id id = station_lookup(input);
+	if (id != STATION_NONE)
+		return id;
+
+	short idx = trie_lookup(input, strlen(input), 1);
+	return idx >= 0 ? idx : STATION_NONE;
+}
@@ -1,11 +1,54 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef uint8_t station_id;             /* dense station id, index into station_defs */
+
+#define STATION_NONE    0xff            /* unknown station */
+
+/* NJ Transit rail lines */
+enum line
+{
+	LINE_NEC        = 1 << 0,       /* Northeast Corridor */
+	LINE_NJCL       = 1 << 1,       /* North Jersey Coast Line */
+	LINE_RARV       = 1 << 2,       /* Raritan Valley Line */
+	LINE_ME         = 1 << 3,       /* Morristown Line */
+	LINE_GLAD       = 1 << 4,       /* Gladstone Branch */
+	LINE_MOBO       = 1 << 5,       /* Montclair-Boonton Line */
+	LINE_MAIN       = 1 << 6,       /* Main Line */
+	LINE_BERG       = 1 << 7,       /* Bergen County Line */
+	LINE_PJ         = 1 << 8,       /* Port Jervis Line */
+	LINE_PASC       = 1 << 9,       /* Pascack Valley Line */
+	LINE_ACRL       = 1 << 10,      /* Atlantic City Rail Line */
+};
+
+/* generated from stations.txt */
+struct station_def
+{
+	const char      *code;          /* station code */
+	const char      *name;          /* canonical station name */
+	unsigned        lines;          /* LINE_* flags */
+};
+
+struct station_synonym
+{
+	const char      *name;          /* other name of the station on NJT pages */
+	station_id      id;             /* station */
+};
+
+extern const struct station_def station_defs[];
+extern const size_t n_stations;
+extern const struct station_synonym station_synonyms[];
+extern const size_t n_synonyms;
+
 extern const char credits[];
 extern const size_t sz_credits;
-extern const char *stations[];
-extern const char *codes[];
-
-void stations_list();
-size_t station_index(const char *code);
-const char *station_name(const char *code);
-const char *station_code(const char *name);
-const char *station_verify_code(const char *code);
 
+void stations_list(FILE *f);
+station_id station_lookup(const char *code);
+station_id station_by_name(const char *name);
+station_id station_find(const char *input);
+const char *station_code(station_id id);
+const char *station_name(station_id id);
+unsigned station_lines(station_id id);
+size_t station_normalize(const char *name, size_t len, char *out, size_t sz);
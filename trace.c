@@ -0,0 +1,139 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/net.h"
+#include "json.h"
+#include "trace.h"
+
+static FILE *trace_file = NULL;
+static int events = 0;                  /* written so far, under trace_lock */
+static struct timespec epoch;           /* time 0 of the trace */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int threads;              /* trace ids handed out */
+static _Thread_local int tid;           /* trace id of the thread, 0 if none yet */
+
+static int64_t
+trace_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)(ts.tv_sec - epoch.tv_sec) * 1000000 + (ts.tv_nsec - epoch.tv_nsec) / 1000;
+}
+
+static void
+trace_close()
+{
+	pthread_mutex_lock(&trace_lock);
+	fputs("\n]\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/* Starts writing the trace to fname. Returns -1 if it can't be created. */
+int
+trace_open(const char *fname)
+{
+	trace_file = fopen(fname, "wt");
+	if (trace_file == NULL)
+		return -1;
+
+	fputs("[", trace_file);
+	clock_gettime(CLOCK_MONOTONIC, &epoch);
+	atexit(trace_close);
+
+	return 0;
+}
+
+static void
+trace_write(const char *cat, const char *name, const char *ph, int64_t ts, int64_t dur,
+	    const char *key, size_t bytes)
+{
+	struct buf b;
+	struct json j;
+
+	if (tid == 0)
+		tid = atomic_fetch_add(&threads, 1) + 1;
+
+	memset(&b, 0, sizeof(struct buf));
+	json_init(&j, &b);
+	json_begin_object(&j);
+	json_key(&j, "name");
+	json_string(&j, name);
+	json_key(&j, "cat");
+	json_string(&j, cat);
+	json_key(&j, "ph");
+	json_string(&j, ph);
+	json_key(&j, "ts");
+	json_int(&j, ts);
+	if (dur >= 0) {
+		json_key(&j, "dur");
+		json_int(&j, dur);
+	} else {
+		json_key(&j, "s");
+		json_string(&j, "t");
+	}
+	json_key(&j, "pid");
+	json_int(&j, getpid());
+	json_key(&j, "tid");
+	json_int(&j, tid);
+	json_key(&j, "args");
+	json_begin_object(&j);
+	if (key != NULL) {
+		json_key(&j, "key");
+		json_string(&j, key);
+	}
+	if (bytes > 0) {
+		json_key(&j, "bytes");
+		json_int(&j, bytes);
+	}
+	json_end_object(&j);
+	json_end_object(&j);
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file != NULL) {
+		fputs(events++ > 0 ? ",\n" : "\n", trace_file);
+		fputs(b.s, trace_file);
+		/* a killed server loses no event */
+		fflush(trace_file);
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	free(b.s);
+}
+
+/* starts a span of the calling thread */
+void
+trace_begin(struct trace_span *s, const char *cat, const char *name)
+{
+	s->cat = cat;
+	s->name = name;
+	s->start = trace_file != NULL ? trace_now() : -1;
+}
+
+/* ends the span, key names what was worked on and bytes its size if known */
+void
+trace_end(struct trace_span *s, const char *key, size_t bytes)
+{
+	if (s->start < 0 || trace_file == NULL)
+		return;
+
+	trace_write(s->cat, s->name, "X", s->start, trace_now() - s->start, key, bytes);
+}
+
+/* an instant in the current span, like a cache hit */
+void
+trace_mark(const char *cat, const char *name, const char *key)
+{
+	if (trace_file == NULL)
+		return;
+
+	trace_write(cat, name, "i", trace_now(), -1, key, 0);
+}
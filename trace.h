@@ -0,0 +1,24 @@
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Request traces in the Chrome trace event format, for chrome://tracing
+ * or Perfetto. With --trace=file every query, board and stops lookup,
+ * page fetch, parse and render is written as a span with its thread,
+ * start, duration and byte count, and cache hits and misses as instants.
+ * Spans of a thread nest by time, so each request shows as a tree. The
+ * array is closed at exit; the viewers also read the file of a server
+ * that was killed.
+ */
+
+struct trace_span
+{
+	const char      *cat;           /* category */
+	const char      *name;          /* step */
+	int64_t         start;          /* us since the trace was opened, -1 if off */
+};
+
+int trace_open(const char *fname);
+void trace_begin(struct trace_span *s, const char *cat, const char *name);
+void trace_end(struct trace_span *s, const char *key, size_t bytes);
+void trace_mark(const char *cat, const char *name, const char *key);
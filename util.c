@@ -1,50 +1,97 @@
+#include "common/net.h"
+#include "stations.h"
+#include "board.h"
 #include "util.h"
+#include "trace.h"
+#include "log.h"
+#include "report.h"
+#include "archive.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
-#include <inttypes.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <time.h>
 
+/*
+ * Maps a saved page read-only, so it is shared through the page cache
+ * instead of copied. The text isn't NUL terminated.
+ */
 int
-read_text(const char *fname, char **text, size_t *len)
+map_text(const char *fname, const char **text, size_t *len)
 {
 	struct stat st;
-	FILE *f = NULL;
-	char *buff = NULL;
-	int ret = -1;
+	void *p;
+	int fd;
 
-	if (stat(fname, &st) != 0) {
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		printf("Cannot open file %s. Error: %d\n", fname, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0) {
 		printf("Cannot stat file %s. Error: %d\n", fname, errno);
-		goto out;
+		close(fd);
+		return -1;
 	}
 
-	f = fopen(fname, "rt");
-	if (f == NULL) {
-		printf("Cannot open file %s. Error: %d\n", fname, errno);
-		goto out;
+	*len = st.st_size;
+	if (*len == 0) {
+		close(fd);
+		*text = "";
+		return 0;
 	}
 
-	buff = malloc(st.st_size + 1);
-	if (buff == NULL) {
-		printf("Cannot allocate %" PRId64 " bytes. Error: %d\n", st.st_size + 1, errno);
-		goto out;
+	p = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("Cannot map file %s. Error: %d\n", fname, errno);
+		return -1;
 	}
 
-	fread(buff, 1, st.st_size, f);
-	fclose(f);
-	f = NULL;
-	buff[st.st_size] = 0;
-	*text = buff;
-	*len = st.st_size;
-	ret = 0;
+	*text = p;
 
-out:
-	if (f != NULL)
-		fclose(f);
+	return 0;
+}
+
+void
+unmap_text(const char *text, size_t len)
+{
+	if (len > 0)
+		munmap((void *)text, len);
+}
+
+/* ===== clock =====
+ *
+ * Boards, stops and reports take the time from clock_now(), which a replay
+ * of archived pages sets to the fetch time of the page it plays, so the
+ * replay ages the cache and dates the trains as the original run did.
+ */
+
+static _Atomic time_t replay_now = 0;          /* time of the replay, 0 if none */
+
+time_t
+clock_now()
+{
+	time_t t = atomic_load_explicit(&replay_now, memory_order_relaxed);
+
+	return t != 0 ? t : time(NULL);
+}
 
-	return ret;
+void
+clock_replay(time_t t)
+{
+	atomic_store(&replay_now, t);
 }
 
 int
@@ -57,10 +104,626 @@ expired(const char *fname)
 		return 1;
 	}
 
-	if (st.st_mtime + 60 < time(NULL)) {
+	if (st.st_mtime + 60 < clock_now()) {
 		return 2;
 	}
 
 	return 0;
 }
 
+/*
+ * Circuit breaker for the upstream site. After CIRCUIT_FAILURES failed
+ * downloads in a row it opens: no requests are sent for CIRCUIT_OPEN
+ * seconds and callers get their stale pages or fail at once. Then one
+ * request probes the site; success closes the circuit, failure opens it
+ * again.
+ */
+
+#define CIRCUIT_FAILURES        5
+#define CIRCUIT_OPEN            30
+
+static atomic_int failures = 0;                 /* failed downloads in a row */
+static atomic_bool offline = false;             /* upstream is never requested */
+static _Atomic time_t open_until = 0;           /* no requests before */
+static atomic_bool probing = false;             /* a request is probing the open circuit */
+
+static void
+ts_add_ms(struct timespec *ts, unsigned ms)
+{
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static int
+ts_cmp(const struct timespec *a, const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec ? -1 : 1;
+
+	return a->tv_nsec < b->tv_nsec ? -1 : a->tv_nsec > b->tv_nsec;
+}
+
+static int
+circuit_allow()
+{
+	if (atomic_load(&failures) < CIRCUIT_FAILURES)
+		return 1;
+
+	if (atomic_load(&open_until) > time(NULL))
+		return 0;
+
+	return !atomic_exchange(&probing, true);
+}
+
+static void
+circuit_result(int ok)
+{
+	if (ok) {
+		atomic_store(&failures, 0);
+	} else if (atomic_fetch_add(&failures, 1) + 1 >= CIRCUIT_FAILURES) {
+		atomic_store(&open_until, time(NULL) + CIRCUIT_OPEN);
+	}
+
+	atomic_store(&probing, false);
+}
+
+/* Returns nonzero while the circuit is open and the upstream is not requested. */
+int
+upstream_down()
+{
+	if (atomic_load_explicit(&offline, memory_order_relaxed))
+		return 1;
+
+	return atomic_load(&failures) >= CIRCUIT_FAILURES && atomic_load(&open_until) > time(NULL);
+}
+
+/* Keeps the circuit open for good, so only saved pages are used. */
+void
+upstream_offline()
+{
+	atomic_store(&offline, true);
+}
+
+/* ===== deadlines and hedged downloads =====
+ *
+ * A query may have a deadline, kept per thread, that bounds every fetch
+ * it makes: past it the caller gets the stale page or fails, while the
+ * downloads keep running in the background and still refresh the cache.
+ * A download that takes longer than the p95 of recent downloads is hedged
+ * with a second request; the first one to finish is renamed into place.
+ */
+
+#define HEDGE_SAMPLES           64      /* recent download latencies kept */
+#define HEDGE_MIN_SAMPLES       16      /* no hedging before the p95 is known */
+#define HEDGE_MIN_MS            50      /* never hedge sooner */
+#define LOCK_POLL_MS            20      /* page lock polling under a deadline */
+#define PEER_WAIT_MS            1000    /* longest wait for a cluster peer */
+
+static unsigned deadline_ms = 0;                /* query deadline, 0 for none */
+static _Thread_local struct timespec deadline;  /* of the thread's query, zero for none */
+
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned latencies[HEDGE_SAMPLES];       /* ms, ring buffer */
+static size_t n_latencies = 0;
+
+struct download
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;           /* signaled when a request finishes */
+	char            url[256];
+	char            fname[PATH_MAX];
+	int             refs;           /* caller and running requests */
+	int             running;        /* requests in flight */
+	int             won;            /* the page was renamed into place */
+	int             peer;           /* from a cluster peer, not upstream */
+	int             empty;          /* the peer answered without a page */
+};
+
+struct attempt
+{
+	struct download *d;
+	char            tmp[PATH_MAX];  /* the request downloads here */
+	struct timespec start;
+	LIST_ENTRY(attempt) entries;    /* in running */
+};
+
+/* attempts whose temp files are removed at exit if they are still running */
+static LIST_HEAD(, attempt) running = LIST_HEAD_INITIALIZER(running);
+static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t running_once = PTHREAD_ONCE_INIT;
+
+/* Sets the deadline of queries in ms, 0 for none. */
+void
+query_deadline_set(unsigned ms)
+{
+	deadline_ms = ms;
+}
+
+/* Starts the deadline of a query made by the calling thread. */
+void
+query_begin()
+{
+	if (deadline_ms == 0) {
+		memset(&deadline, 0, sizeof(deadline));
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	ts_add_ms(&deadline, deadline_ms);
+}
+
+static int
+deadline_passed()
+{
+	struct timespec now;
+
+	if (deadline.tv_sec == 0)
+		return 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ts_cmp(&now, &deadline) >= 0;
+}
+
+static void
+latency_add(unsigned ms)
+{
+	pthread_mutex_lock(&latency_lock);
+	latencies[n_latencies++ % HEDGE_SAMPLES] = ms;
+	pthread_mutex_unlock(&latency_lock);
+}
+
+static int
+compare_unsigned(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* returns the p95 of recent download latencies in ms, 0 if unknown */
+static unsigned
+latency_p95()
+{
+	unsigned sorted[HEDGE_SAMPLES];
+	size_t n;
+
+	pthread_mutex_lock(&latency_lock);
+	n = n_latencies < HEDGE_SAMPLES ? n_latencies : HEDGE_SAMPLES;
+	memcpy(sorted, latencies, n * sizeof(unsigned));
+	pthread_mutex_unlock(&latency_lock);
+
+	if (n < HEDGE_MIN_SAMPLES)
+		return 0;
+
+	qsort(sorted, n, sizeof(unsigned), compare_unsigned);
+	return sorted[n * 95 / 100];
+}
+
+static void
+download_unref(struct download *d)
+{
+	int last = --d->refs == 0;
+
+	pthread_mutex_unlock(&d->lock);
+
+	if (last) {
+		pthread_cond_destroy(&d->cond);
+		pthread_mutex_destroy(&d->lock);
+		free(d);
+	}
+}
+
+static void *
+attempt_run(void *arg)
+{
+	struct attempt *a = arg;
+	struct download *d = a->d;
+	struct timespec end;
+	struct stat st;
+	struct httpreq_opts opts = {
+		.resp_fname = a->tmp
+	};
+	int ok, empty = 0;
+
+	ok = httpreq(d->url, NULL, &opts) == 0;
+
+	if (d->peer) {
+		/* a peer that can't get the page answers with an empty body */
+		empty = ok && stat(a->tmp, &st) == 0 && st.st_size == 0;
+		ok = ok && !empty;
+	} else {
+		circuit_result(ok);
+		if (ok) {
+			clock_gettime(CLOCK_REALTIME, &end);
+			latency_add((end.tv_sec - a->start.tv_sec) * 1000 + (end.tv_nsec - a->start.tv_nsec) / 1000000);
+		}
+	}
+
+	pthread_mutex_lock(&d->lock);
+
+	if (empty)
+		d->empty = 1;
+
+	/* archived before the rename, so a page that comes in late is too */
+	if (ok && !d->won && !d->peer)
+		archive_page(d->fname, a->tmp);
+
+	pthread_mutex_lock(&running_lock);
+	if (ok && !d->won && rename(a->tmp, d->fname) == 0)
+		d->won = 1;
+	else
+		unlink(a->tmp);
+	LIST_REMOVE(a, entries);
+	pthread_mutex_unlock(&running_lock);
+
+	d->running--;
+	pthread_cond_broadcast(&d->cond);
+	download_unref(d);
+
+	free(a);
+	return NULL;
+}
+
+/* a query that gave up at its deadline leaves its attempts running */
+static void
+running_clean()
+{
+	struct attempt *a;
+
+	pthread_mutex_lock(&running_lock);
+	LIST_FOREACH(a, &running, entries)
+		unlink(a->tmp);
+	pthread_mutex_unlock(&running_lock);
+}
+
+static void
+running_init()
+{
+	atexit(running_clean);
+}
+
+/* starts one request of the download, under d->lock */
+static int
+attempt_start(struct download *d)
+{
+	struct attempt *a;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fd, rc;
+
+	a = calloc(1, sizeof(struct attempt));
+	if (a == NULL)
+		return -1;
+
+	pthread_once(&running_once, running_init);
+
+	a->d = d;
+	if (snprintf(a->tmp, sizeof(a->tmp), "%s.XXXXXX", d->fname) >= (int)sizeof(a->tmp)) {
+		free(a);
+		return -1;
+	}
+
+	pthread_mutex_lock(&running_lock);
+	fd = mkstemp(a->tmp);
+	if (fd >= 0)
+		LIST_INSERT_HEAD(&running, a, entries);
+	pthread_mutex_unlock(&running_lock);
+
+	if (fd < 0) {
+		free(a);
+		return -1;
+	}
+	close(fd);
+
+	clock_gettime(CLOCK_REALTIME, &a->start);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&thread, &attr, attempt_run, a);
+	pthread_attr_destroy(&attr);
+
+	if (rc != 0) {
+		pthread_mutex_lock(&running_lock);
+		LIST_REMOVE(a, entries);
+		pthread_mutex_unlock(&running_lock);
+		unlink(a->tmp);
+		free(a);
+		return -1;
+	}
+
+	d->refs++;
+	d->running++;
+
+	return 0;
+}
+
+/* returns a new download of url into fname, locked */
+static struct download *
+download_new(const char *url, const char *fname)
+{
+	struct download *d;
+
+	d = calloc(1, sizeof(struct download));
+	if (d == NULL)
+		return NULL;
+
+	pthread_mutex_init(&d->lock, NULL);
+	pthread_cond_init(&d->cond, NULL);
+	snprintf(d->url, sizeof(d->url), "%s", url);
+	snprintf(d->fname, sizeof(d->fname), "%s", fname);
+	d->refs = 1;
+
+	pthread_mutex_lock(&d->lock);
+	return d;
+}
+
+/*
+ * Downloads url into fname, hedging a slow request and giving up at the
+ * query deadline. Returns 0 if a fresh page was renamed into place.
+ */
+static int
+download(const char *url, const char *fname)
+{
+	struct download *d;
+	struct timespec hedge_at, *wake;
+	struct trace_span span;
+	struct stat st;
+	unsigned p95 = latency_p95();
+	int hedged = p95 == 0, rc;
+
+	d = download_new(url, fname);
+	if (d == NULL)
+		return -1;
+
+	trace_begin(&span, "fetch", "download");
+
+	if (attempt_start(d) != 0) {
+		/* the probe of an open circuit didn't go out */
+		atomic_store(&probing, false);
+		download_unref(d);
+		trace_end(&span, url, 0);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &hedge_at);
+	ts_add_ms(&hedge_at, p95 > HEDGE_MIN_MS ? p95 : HEDGE_MIN_MS);
+
+	while (!d->won && d->running > 0) {
+		wake = !hedged ? &hedge_at : NULL;
+		if (deadline.tv_sec != 0 && (wake == NULL || ts_cmp(&deadline, wake) < 0))
+			wake = &deadline;
+
+		rc = wake != NULL ? pthread_cond_timedwait(&d->cond, &d->lock, wake) : pthread_cond_wait(&d->cond, &d->lock);
+		if (rc != ETIMEDOUT)
+			continue;
+
+		if (wake == &deadline) {
+			trace_mark("fetch", "deadline passed", url);
+			log_text(LEVEL_WARN, "deadline passed", NULL, url, strlen(url));
+			break;
+		}
+
+		/* no second request while the circuit breaker is probing */
+		hedged = 1;
+		if (atomic_load(&failures) < CIRCUIT_FAILURES && attempt_start(d) == 0) {
+			trace_mark("fetch", "hedged", url);
+			log_add(LEVEL_INFO, "hedged after ms", NULL, p95, url, strlen(url));
+		}
+	}
+
+	rc = d->won ? 0 : -1;
+	download_unref(d);
+	trace_end(&span, url, rc == 0 && stat(fname, &st) == 0 ? st.st_size : 0);
+
+	return rc;
+}
+
+/*
+ * Downloads url from a cluster peer into fname, waiting no longer than
+ * PEER_WAIT_MS and half the time left to the query deadline, so that a
+ * hung peer leaves time to fetch the page upstream. Returns 0 if the page
+ * was renamed into place, 1 if the peer answered without a page and -1 if
+ * it didn't answer in time.
+ */
+static int
+peer_download(const char *url, const char *fname)
+{
+	struct download *d;
+	struct timespec now, wake;
+	struct trace_span span;
+	struct stat st;
+	long left;
+	int rc;
+
+	d = download_new(url, fname);
+	if (d == NULL)
+		return -1;
+	d->peer = 1;
+
+	trace_begin(&span, "fetch", "peer");
+
+	if (attempt_start(d) != 0) {
+		download_unref(d);
+		trace_end(&span, url, 0);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	wake = now;
+	ts_add_ms(&wake, PEER_WAIT_MS);
+	if (deadline.tv_sec != 0) {
+		left = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (left < 2 * PEER_WAIT_MS) {
+			wake = now;
+			ts_add_ms(&wake, left > 0 ? left / 2 : 0);
+		}
+	}
+
+	while (!d->won && d->running > 0)
+		if (pthread_cond_timedwait(&d->cond, &d->lock, &wake) == ETIMEDOUT) {
+			trace_mark("fetch", "peer timed out", url);
+			log_text(LEVEL_WARN, "peer timed out", NULL, url, strlen(url));
+			break;
+		}
+
+	rc = d->won ? 0 : d->empty ? 1 : -1;
+	download_unref(d);
+	trace_end(&span, url, rc == 0 && stat(fname, &st) == 0 ? st.st_size : 0);
+
+	return rc;
+}
+
+/* takes the page lock, waiting for it no longer than the query deadline */
+static int
+lock_page(int fd, int wait)
+{
+	if (!wait)
+		return flock(fd, LOCK_EX | LOCK_NB);
+
+	if (deadline.tv_sec == 0)
+		return flock(fd, LOCK_EX);
+
+	while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		if (errno != EWOULDBLOCK || deadline_passed())
+			return -1;
+		usleep(LOCK_POLL_MS * 1000);
+	}
+
+	return 0;
+}
+
+/*
+ * Refreshes the cached page fname from url if it is expired.
+ *
+ * One process per page refreshes it while holding fname.lock; it downloads
+ * into a temp file and renames it over fname, so readers never see a
+ * partial page. Others keep using the stale page meanwhile, or wait for
+ * the refresh if there is no page yet. While the upstream circuit is open
+ * nothing is downloaded, and nothing is waited for past the query
+ * deadline. Returns 0 if fname can be read.
+ */
+int
+fetch_page(const char *url, const char *fname)
+{
+	char lock[PATH_MAX];
+	int fd, stale, rc = 0;
+
+	if (!expired(fname)) {
+		trace_mark("cache", "page fresh", fname);
+		return 0;
+	}
+
+	stale = access(fname, R_OK) == 0;
+
+	if (upstream_down() || deadline_passed()) {
+		trace_mark("fetch", "not fetched", fname);
+		return stale ? 0 : -1;
+	}
+
+	snprintf(lock, sizeof(lock), "%s.lock", fname);
+	fd = open(lock, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return stale ? 0 : -1;
+
+	if (lock_page(fd, !stale) != 0) {
+		/* another process is refreshing it */
+		close(fd);
+		return stale ? 0 : -1;
+	}
+
+	/* refreshed while we waited for the lock */
+	if (!expired(fname))
+		goto out;
+
+	if (!circuit_allow() || download(url, fname) != 0)
+		rc = stale ? 0 : -1;
+
+out:
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	return rc;
+}
+
+/*
+ * Refreshes the cached page fname from url on a peer cluster node if it is
+ * expired, under the same page lock as fetch_page(). Peers are neither
+ * hedged nor counted by the upstream circuit breaker. Returns 0 if fname
+ * is fresh, 1 if the peer answered without a page, which it couldn't get
+ * upstream either, and -1 if the peer can't be reached in time.
+ */
+int
+fetch_peer(const char *url, const char *fname)
+{
+	char lock[PATH_MAX];
+	int fd, rc = -1;
+
+	if (!expired(fname)) {
+		trace_mark("cache", "page fresh", fname);
+		return 0;
+	}
+
+	snprintf(lock, sizeof(lock), "%s.lock", fname);
+	fd = open(lock, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return -1;
+
+	if (lock_page(fd, 1) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (!expired(fname)) {
+		rc = 0;
+		goto out;
+	}
+
+	rc = peer_download(url, fname);
+
+out:
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	return rc;
+}
+
+/*
+ * Returns the first time at or after base that shows the "H:MM" clock time
+ * of the NJT pages, which leave out AM and PM, or -1 if s is not a time.
+ */
+time_t
+clock_time(const char *s, time_t base)
+{
+	struct tm tm;
+	time_t t;
+	int h, m;
+
+	if (s == NULL || sscanf(s, " %d:%d", &h, &m) != 2 || h < 0 || h > 23 || m < 0 || m > 59)
+		return -1;
+
+	localtime_r(&base, &tm);
+	tm.tm_hour = h > 12 ? h : h % 12;
+	tm.tm_min = m;
+	tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+
+	for (t = mktime(&tm); t < base; t += h > 12 ? 24 * 3600 : 12 * 3600)
+		;
+
+	return t;
+}
+
+/* Returns the NJT service day of t as yyyymmdd, days start at 3 AM. */
+int
+service_day(time_t t)
+{
+	struct tm tm;
+
+	t -= SERVICE_DAY;
+	localtime_r(&t, &tm);
+
+	return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
@@ -1,5 +1,20 @@
+#include <time.h>
 #include <unistd.h>
 
-int read_text(const char *fname, char **text, size_t *len);
+int map_text(const char *fname, const char **text, size_t *len);
+void unmap_text(const char *text, size_t len);
 int expired(const char *fname);
 
+int fetch_page(const char *url, const char *fname);
+int fetch_peer(const char *url, const char *fname);
+int upstream_down(void);
+void upstream_offline(void);
+void query_deadline_set(unsigned ms);
+void query_begin(void);
+time_t clock_time(const char *s, time_t base);
+time_t clock_now(void);
+void clock_replay(time_t t);
+
+#define SERVICE_DAY     (3 * 3600)      /* the NJT service day starts at 3 AM */
+
+int service_day(time_t t);